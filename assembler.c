@@ -0,0 +1,338 @@
+/*
+ * Two-pass assembler for LC-2K assembly (.as) files.
+ * The whole source is read in one go and tokenized in place; labels go in
+ * an open-addressing hash table, so resolving them does not depend on the
+ * number of labels. The machine code is formatted into one buffer and
+ * written at once, either as text (one decimal word per line, the .mc
+ * format the simulator reads) or, with -b, as a binary image of 32-bit
+ * little-endian words.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lc2k.h"
+
+#define MAXLABELLENGTH 6
+#define MAXFIELDS 5  // label, opcode and up to three arguments; the rest is a comment
+
+typedef struct lineStruct {
+    char* field[MAXFIELDS];  // label ("" if none), opcode, arg0..arg2 (NULL if missing)
+    int lineNum;             // line in the source file, for errors
+} lineType;
+
+typedef struct symbolStruct {
+    char* name;              // NULL: empty slot
+    int address;
+} symbolType;
+
+typedef struct symbolTableStruct {
+    symbolType* slot;
+    unsigned int mask;       // number of slots - 1 (a power of two)
+} symbolTableType;
+
+char* readFile(char*, size_t*);
+int tokenize(char*, size_t, lineType**);
+unsigned int hashLabel(char*);
+void addLabel(symbolTableType*, char*, int, int);
+symbolType* findLabel(symbolTableType*, char*);
+int isNumber(char*);
+int regArg(lineType*, int);
+int offsetArg(lineType*, int, symbolTableType*, int);
+int assemble(lineType*, int, symbolTableType*);
+
+int main(int argc, char* argv[]) {
+    int binary = 0;  // -b: write a binary image instead of text
+
+    int argi = 1;
+    if (argc == 4 && !strcmp(argv[1], "-b")) {
+        binary = 1;
+        argi = 2;
+    }
+    if (argc - argi != 2) {
+        printf("error: usage: %s [-b] <assembly-code-file> <machine-code-file>\n", argv[0]);
+        exit(1);
+    }
+
+    size_t size;
+    char* source = readFile(argv[argi], &size);
+    lineType* lines;
+    int numLines = tokenize(source, size, &lines);
+
+    // first pass: label addresses
+    symbolTableType symbols;
+    unsigned int numLabels = 0;
+    for (int address = 0; address < numLines; ++address) {
+        numLabels += *lines[address].field[0] != '\0';
+    }
+    symbols.mask = 15;
+    while (symbols.mask < 2 * numLabels) {
+        symbols.mask = symbols.mask * 2 + 1;
+    }
+    symbols.slot = calloc(symbols.mask + 1, sizeof(symbolType));
+    for (int address = 0; address < numLines; ++address) {
+        if (*lines[address].field[0]) {
+            addLabel(&symbols, lines[address].field[0], address, lines[address].lineNum);
+        }
+    }
+
+    // second pass: encode
+    char* out = malloc(binary ? 4 * (size_t)numLines + 1 : 12 * (size_t)numLines + 1);
+    char* end = out;
+    for (int address = 0; address < numLines; ++address) {
+        int word = assemble(lines + address, address, &symbols);
+        if (binary) {
+            for (int i = 0; i < 4; ++i) {
+                *end++ = (char)((unsigned int)word >> (8 * i));
+            }
+        } else {
+            end = formatNum(end, word);
+            *end++ = '\n';
+        }
+    }
+
+    FILE* outFilePtr = fopen(argv[argi + 1], binary ? "wb" : "w");
+    if (outFilePtr == NULL) {
+        printf("error in opening %s\n", argv[argi + 1]);
+        exit(1);
+    }
+    if (fwrite(out, 1, end - out, outFilePtr) != (size_t)(end - out) || fclose(outFilePtr)) {
+        printf("error in writing %s\n", argv[argi + 1]);
+        exit(1);
+    }
+    return 0;
+}
+
+// the whole file in one NUL-terminated buffer
+char* readFile(char* filename, size_t* size) {
+    FILE* inFilePtr = fopen(filename, "rb");
+    if (inFilePtr == NULL) {
+        printf("error in opening %s\n", filename);
+        exit(1);
+    }
+    size_t capacity = 1 << 16;
+    char* buffer = malloc(capacity);
+    *size = 0;
+    size_t got;
+    while ((got = fread(buffer + *size, 1, capacity - *size - 1, inFilePtr)) > 0) {
+        *size += got;
+        if (*size + 1 == capacity) {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+        }
+    }
+    fclose(inFilePtr);
+    buffer[*size] = '\0';
+    return buffer;
+}
+
+/*
+ * Split the source into lines and fields, NUL-terminating the fields in
+ * place. A line that starts with whitespace has no label. Lines with
+ * nothing on them are skipped. Returns the number of lines, which is also
+ * the number of words of machine code.
+ **/
+int tokenize(char* source, size_t size, lineType** linesPtr) {
+    int capacity = 1024, numLines = 0;
+    lineType* lines = malloc(capacity * sizeof(lineType));
+    char* end = source + size;
+    int lineNum = 0;
+    for (char* p = source; p < end;) {
+        ++lineNum;
+        char* eol = memchr(p, '\n', end - p);
+        if (eol == NULL) {
+            eol = end;
+        }
+        *eol = '\0';
+        if (numLines == capacity) {
+            capacity *= 2;
+            lines = realloc(lines, capacity * sizeof(lineType));
+        }
+        lineType* line = lines + numLines;
+        line->lineNum = lineNum;
+        int numFields = 0;
+        int hasLabel = *p != ' ' && *p != '\t' && *p != '\r';
+        if (!hasLabel) {
+            line->field[numFields++] = "";
+        }
+        while (numFields < MAXFIELDS) {
+            while (*p == ' ' || *p == '\t' || *p == '\r') {
+                ++p;
+            }
+            if (*p == '\0') {
+                break;
+            }
+            line->field[numFields++] = p;
+            while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r') {
+                ++p;
+            }
+            if (*p != '\0') {
+                *p++ = '\0';
+            }
+        }
+        if (numFields > 1 || (numFields == 1 && hasLabel)) {
+            for (int i = numFields; i < MAXFIELDS; ++i) {
+                line->field[i] = NULL;
+            }
+            ++numLines;
+        }
+        p = eol + 1;
+    }
+    *linesPtr = lines;
+    return numLines;
+}
+
+// FNV-1a
+unsigned int hashLabel(char* label) {
+    unsigned int hash = 2166136261u;
+    for (; *label; ++label) {
+        hash = (hash ^ (unsigned char)*label) * 16777619u;
+    }
+    return hash;
+}
+
+void addLabel(symbolTableType* symbols, char* label, int address, int lineNum) {
+    size_t length = strlen(label);
+    int valid = length <= MAXLABELLENGTH &&
+                ((*label >= 'a' && *label <= 'z') || (*label >= 'A' && *label <= 'Z'));
+    for (size_t i = 1; valid && i < length; ++i) {
+        char c = label[i];
+        valid = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+    }
+    if (!valid) {
+        printf("error: line %d: bad label '%s'\n", lineNum, label);
+        exit(1);
+    }
+    unsigned int i = hashLabel(label) & symbols->mask;
+    for (; symbols->slot[i].name != NULL; i = (i + 1) & symbols->mask) {
+        if (!strcmp(symbols->slot[i].name, label)) {
+            printf("error: line %d: duplicate label '%s'\n", lineNum, label);
+            exit(1);
+        }
+    }
+    symbols->slot[i].name = label;
+    symbols->slot[i].address = address;
+}
+
+symbolType* findLabel(symbolTableType* symbols, char* label) {
+    unsigned int i = hashLabel(label) & symbols->mask;
+    for (; symbols->slot[i].name != NULL; i = (i + 1) & symbols->mask) {
+        if (!strcmp(symbols->slot[i].name, label)) {
+            return symbols->slot + i;
+        }
+    }
+    return NULL;
+}
+
+// is string a decimal integer (with optional sign)?
+int isNumber(char* string) {
+    if (*string == '-' || *string == '+') {
+        ++string;
+    }
+    if (*string == '\0') {
+        return 0;
+    }
+    for (; *string; ++string) {
+        if (*string < '0' || *string > '9') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// register number in argument i of line
+int regArg(lineType* line, int i) {
+    char* arg = line->field[2 + i];
+    if (arg == NULL) {
+        printf("error: line %d: missing register argument\n", line->lineNum);
+        exit(1);
+    }
+    if (!isNumber(arg)) {
+        printf("error: line %d: register '%s' is not an integer\n", line->lineNum, arg);
+        exit(1);
+    }
+    long reg = strtol(arg, NULL, 10);
+    if (reg < 0 || reg >= NUMREGS) {
+        printf("error: line %d: register %ld out of range\n", line->lineNum, reg);
+        exit(1);
+    }
+    return (int)reg;
+}
+
+// 16-bit offset in argument 2 of line: a number, a label's address, or for beq the distance to a label
+int offsetArg(lineType* line, int address, symbolTableType* symbols, int relative) {
+    char* arg = line->field[4];
+    long offset;
+    if (arg == NULL) {
+        printf("error: line %d: missing offset\n", line->lineNum);
+        exit(1);
+    }
+    if (isNumber(arg)) {
+        offset = strtol(arg, NULL, 10);
+    } else {
+        symbolType* symbol = findLabel(symbols, arg);
+        if (symbol == NULL) {
+            printf("error: line %d: undefined label '%s'\n", line->lineNum, arg);
+            exit(1);
+        }
+        offset = relative ? symbol->address - address - 1 : symbol->address;
+    }
+    if (offset < -32768 || offset > 32767) {
+        printf("error: line %d: offset %ld out of range\n", line->lineNum, offset);
+        exit(1);
+    }
+    return (int)offset & 0xffff;
+}
+
+int assemble(lineType* line, int address, symbolTableType* symbols) {
+    static const char* names[] = {"add", "nor", "lw", "sw", "beq", "jalr", "halt", "noop"};
+    char* opName = line->field[1];
+    if (opName == NULL) {
+        printf("error: line %d: missing opcode\n", line->lineNum);
+        exit(1);
+    }
+    if (!strcmp(opName, ".fill")) {
+        char* arg = line->field[2];
+        if (arg == NULL) {
+            printf("error: line %d: missing .fill value\n", line->lineNum);
+            exit(1);
+        }
+        if (isNumber(arg)) {
+            long value = strtol(arg, NULL, 10);
+            if (value < -2147483648L || value > 2147483647L) {
+                printf("error: line %d: .fill value %s out of range\n", line->lineNum, arg);
+                exit(1);
+            }
+            return (int)value;
+        }
+        symbolType* symbol = findLabel(symbols, arg);
+        if (symbol == NULL) {
+            printf("error: line %d: undefined label '%s'\n", line->lineNum, arg);
+            exit(1);
+        }
+        return symbol->address;
+    }
+
+    int op = 0;
+    while (op < 8 && strcmp(opName, names[op])) {
+        ++op;
+    }
+    switch (op) {
+        case ADD:
+        case NOR:
+            return (op << 22) | (regArg(line, 0) << 19) | (regArg(line, 1) << 16) | regArg(line, 2);
+        case LW:
+        case SW:
+        case BEQ:
+            return (op << 22) | (regArg(line, 0) << 19) | (regArg(line, 1) << 16) |
+                   offsetArg(line, address, symbols, op == BEQ);
+        case JALR:
+            return (op << 22) | (regArg(line, 0) << 19) | (regArg(line, 1) << 16);
+        case HALT:
+        case NOOP:
+            return op << 22;
+    }
+    printf("error: line %d: unrecognized opcode '%s'\n", line->lineNum, opName);
+    exit(1);
+}
@@ -0,0 +1,204 @@
+/*
+ * Writing and reading binary pipeline traces (see bintrace.h).
+ **/
+
+#define _POSIX_C_SOURCE 200809L  // fseeko
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "bintrace.h"
+
+static void binPut(binTraceType* trace, const void* data, size_t size) {
+    if (fwrite(data, 1, size, trace->file) != size) {
+        printf("error in writing binary trace\n");
+        exit(1);
+    }
+    trace->offset += size;
+}
+
+static void binPutInt(binTraceType* trace, int value) {
+    binPut(trace, &value, sizeof(value));
+}
+
+void binTraceOpen(binTraceType* trace, char* filename, int numMemory) {
+    trace->file = fopen(filename, "wb");
+    if (trace->file == NULL) {
+        printf("error: can't open file %s\n", filename);
+        exit(1);
+    }
+    trace->numMemory = numMemory;
+    trace->offset = 0;
+    trace->numIndex = 0;
+    trace->capacity = 64;
+    trace->index = malloc(trace->capacity * sizeof(binIndexType));
+    binPut(trace, BINMAGIC, 8);
+    binPutInt(trace, numMemory);
+    binPutInt(trace, BINSNAPSHOTINTERVAL);
+}
+
+// record the state before a cycle, preceded by a snapshot every BINSNAPSHOTINTERVAL cycles
+void binTraceState(binTraceType* trace, stateType* state) {
+    if (trace->numIndex == 0 || state->cycles - trace->lastSnapshot >= BINSNAPSHOTINTERVAL) {
+        if (trace->numIndex == trace->capacity) {
+            trace->capacity *= 2;
+            trace->index = realloc(trace->index, trace->capacity * sizeof(binIndexType));
+        }
+        binIndexType entry = {state->cycles, 0, trace->offset};
+        trace->index[trace->numIndex++] = entry;
+        trace->lastSnapshot = state->cycles;
+        binPutInt(trace, BINSNAPSHOT);
+        binPutInt(trace, (int)state->cycles);
+        binPut(trace, state->dataMem, (size_t)trace->numMemory * sizeof(int));
+    }
+    binStateType record;
+    record.cycles = state->cycles;
+    record.pc = state->pc;
+    memcpy(record.reg, state->reg, sizeof(record.reg));
+    record.IFID = state->IFID;
+    record.IDEX = state->IDEX;
+    record.EXMEM = state->EXMEM;
+    record.MEMWB = state->MEMWB;
+    record.WBEND = state->WBEND;
+    binPutInt(trace, BINSTATE);
+    binPut(trace, &record, sizeof(record));
+}
+
+// record the memory word the cycle stored, if any; words past numMemory are never printed
+void binTraceCycle(binTraceType* trace, cycleInfoType* info) {
+    if (opcode(info->memInstr) == SW && info->memAddr >= 0 && info->memAddr < trace->numMemory) {
+        int write[3] = {BINWRITE, info->memAddr, info->memData};
+        binPut(trace, write, sizeof(write));
+    }
+}
+
+// write the index; later calls do nothing
+void binTraceClose(binTraceType* trace) {
+    if (trace->file == NULL) {
+        return;
+    }
+    binTrailerType trailer = {trace->offset, trace->numIndex, BININDEXMAGIC};
+    binPutInt(trace, BINEND);
+    binPut(trace, trace->index, trace->numIndex * sizeof(binIndexType));
+    binPut(trace, &trailer, sizeof(trailer));
+    if (fclose(trace->file)) {
+        printf("error in writing binary trace\n");
+        exit(1);
+    }
+    trace->file = NULL;
+    free(trace->index);
+}
+
+static void binGet(binTraceType* trace, void* data, size_t size) {
+    if (fread(data, 1, size, trace->file) != size) {
+        printf("error: binary trace is truncated\n");
+        exit(1);
+    }
+}
+
+static void binSeek(binTraceType* trace, unsigned long long offset) {
+    if (fseeko(trace->file, (off_t)offset, SEEK_SET)) {
+        printf("error: binary trace is truncated\n");
+        exit(1);
+    }
+}
+
+// open a trace and read its index
+void binTraceLoad(binTraceType* trace, char* filename) {
+    trace->file = fopen(filename, "rb");
+    if (trace->file == NULL) {
+        printf("error: can't open file %s\n", filename);
+        exit(1);
+    }
+    char magic[8];
+    int header[2];
+    binGet(trace, magic, sizeof(magic));
+    binGet(trace, header, sizeof(header));
+    if (memcmp(magic, BINMAGIC, 8) || header[0] < 0 || header[0] > NUMMEMORY) {
+        printf("error: %s is not a binary trace\n", filename);
+        exit(1);
+    }
+    trace->numMemory = header[0];
+
+    binTrailerType trailer;
+    if (fseeko(trace->file, -(off_t)sizeof(trailer), SEEK_END)) {
+        printf("error: binary trace is truncated\n");
+        exit(1);
+    }
+    binGet(trace, &trailer, sizeof(trailer));
+    if (memcmp(trailer.magic, BININDEXMAGIC, 4)) {
+        printf("error: %s has no index (the simulation did not finish)\n", filename);
+        exit(1);
+    }
+    trace->numIndex = trace->capacity = trailer.numIndex;
+    trace->index = malloc((trailer.numIndex + 1) * sizeof(binIndexType));
+    binSeek(trace, trailer.indexOffset + sizeof(int));
+    binGet(trace, trace->index, trailer.numIndex * sizeof(binIndexType));
+    trace->offset = trailer.indexOffset;
+}
+
+// read on to the next state record; returns 0 at the end of the trace
+int binTraceNext(binTraceType* trace, stateType* state) {
+    for (;;) {
+        int tag, write[2];
+        binStateType record;
+        binGet(trace, &tag, sizeof(tag));
+        switch (tag) {
+            case BINSNAPSHOT:
+                binGet(trace, write, sizeof(int));
+                binGet(trace, state->dataMem, (size_t)trace->numMemory * sizeof(int));
+                break;
+            case BINWRITE:
+                binGet(trace, write, sizeof(write));
+                if (write[0] < 0 || write[0] >= trace->numMemory) {
+                    printf("error: binary trace writes address %d\n", write[0]);
+                    exit(1);
+                }
+                state->dataMem[write[0]] = write[1];
+                break;
+            case BINSTATE:
+                binGet(trace, &record, sizeof(record));
+                state->numMemory = (unsigned int)trace->numMemory;
+                state->cycles = record.cycles;
+                state->pc = record.pc;
+                memcpy(state->reg, record.reg, sizeof(state->reg));
+                state->IFID = record.IFID;
+                state->IDEX = record.IDEX;
+                state->EXMEM = record.EXMEM;
+                state->MEMWB = record.MEMWB;
+                state->WBEND = record.WBEND;
+                return 1;
+            case BINEND:
+                binSeek(trace, trace->offset);  // stay at the end
+                return 0;
+            default:
+                printf("error: binary trace is corrupt\n");
+                exit(1);
+        }
+    }
+}
+
+// the state before cycle, from the closest snapshot at or before it; returns 0 if the trace lacks it
+int binTraceSeek(binTraceType* trace, unsigned int cycle, stateType* state) {
+    unsigned int low = 0, high = trace->numIndex;  // first entry after cycle
+    while (low < high) {
+        unsigned int mid = (low + high) / 2;
+        if (trace->index[mid].cycle <= cycle) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low == 0) {
+        return 0;
+    }
+    binSeek(trace, trace->index[low - 1].offset);
+    while (binTraceNext(trace, state)) {
+        if (state->cycles >= cycle) {
+            return state->cycles == cycle;
+        }
+    }
+    return 0;
+}
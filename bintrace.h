@@ -0,0 +1,75 @@
+/*
+ * Binary pipeline traces: every cycle's state in a fixed-width record,
+ * sparse memory writes, periodic memory snapshots and a cycle index at the
+ * end, so a reader can jump to any cycle without scanning the file.
+ *
+ * File layout (ints in host byte order):
+ *   header    "LC2KTRC1", numMemory, snapshot interval
+ *   records   a tag followed by its payload:
+ *     BINSNAPSHOT  cycle, numMemory words of dataMem (as of the next state)
+ *     BINSTATE     binStateType: pc, registers and pipeline registers
+ *     BINWRITE     addr, value: a sw of the cycle that started from the last state
+ *   BINEND, then numIndex binIndexType entries, one per snapshot
+ *   trailer   binTrailerType
+ **/
+
+#ifndef BINTRACE_H
+#define BINTRACE_H
+
+#include <stdio.h>
+
+#include "pipeline.h"
+
+#define BINMAGIC "LC2KTRC1"
+#define BININDEXMAGIC "LCIX"
+#define BINSNAPSHOTINTERVAL 1024  // cycles between memory snapshots
+
+#define BINSNAPSHOT 1
+#define BINSTATE 2
+#define BINWRITE 3
+#define BINEND 4
+
+typedef struct binStateStruct {
+    unsigned int cycles;
+    int pc;
+    int reg[NUMREGS];
+    IFIDType IFID;
+    IDEXType IDEX;
+    EXMEMType EXMEM;
+    MEMWBType MEMWB;
+    WBENDType WBEND;
+} binStateType;
+
+typedef struct binIndexStruct {
+    unsigned int cycle;                 // first state after the snapshot
+    unsigned int pad;
+    unsigned long long offset;          // of the snapshot's tag
+} binIndexType;
+
+typedef struct binTrailerStruct {
+    unsigned long long indexOffset;     // of the BINEND tag
+    unsigned int numIndex;
+    char magic[4];
+} binTrailerType;
+
+typedef struct binTraceStruct {
+    FILE* file;
+    int numMemory;
+    unsigned long long offset;          // writer: bytes written so far
+    unsigned int lastSnapshot;          // writer: cycle of the last snapshot
+    binIndexType* index;
+    unsigned int numIndex, capacity;
+} binTraceType;
+
+// writing, from the simulator
+void binTraceOpen(binTraceType*, char*, int);
+void binTraceState(binTraceType*, stateType*);
+void binTraceCycle(binTraceType*, cycleInfoType*);
+void binTraceClose(binTraceType*);
+
+// reading
+void binTraceLoad(binTraceType*, char*);
+int binTraceSeek(binTraceType*, unsigned int, stateType*);
+int binTraceNext(binTraceType*, stateType*);
+
+#endif
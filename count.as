@@ -0,0 +1,14 @@
+	lw	0	1	n
+	lw	0	2	neg
+	lw	0	3	acc
+	lw	0	4	two
+loop	add	3	4	3
+	add	1	2	1
+	beq	1	0	done
+	beq	0	0	loop
+done	sw	0	3	acc
+	halt
+n	.fill	3000
+neg	.fill	-1
+acc	.fill	7
+two	.fill	2
@@ -0,0 +1,189 @@
+/*
+ * Byte-for-byte replacement for printState without printf.
+ * Numbers go through formatNum, the "\t\tdataMem[ i ] = " prefixes are
+ * built once, and each instruction's "word ( disassembly )" text is kept
+ * in a small direct-mapped cache; both live in a fastFormatType, one per
+ * formatting thread. fastPrintState collects blocks in one buffer that is
+ * written out when it fills up and by fastPrintFlush; until then nothing
+ * else may be printed to stdout.
+ **/
+
+#define _POSIX_C_SOURCE 200809L  // write
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fastprint.h"
+
+#define FASTBUFFER (1 << 20)  // bytes collected before a write
+
+static fastFormatType format;
+static char* buffer;
+static size_t length, capacity;
+
+static char* putText(char* out, const char* text, size_t size) {
+    memcpy(out, text, size);
+    return out + size;
+}
+
+#define PUT(out, literal) putText(out, literal, sizeof(literal) - 1)
+
+// "instruction = " is already out; add "word ( disassembly )\n"
+static char* putInstruction(fastFormatType* format, char* out, int instr) {
+    fastInstrType* slot = format->cache + (((unsigned int)instr * 2654435761u) >> 22) % FASTCACHE;
+    if (slot->length == 0 || slot->instr != instr) {
+        char text[FASTLINE];
+        instructionText(instr, text);
+        char* end = formatNum(slot->text, instr);
+        end = PUT(end, " ( ");
+        end = putText(end, text, strlen(text));
+        end = PUT(end, " )\n");
+        slot->instr = instr;
+        slot->length = (int)(end - slot->text);
+    }
+    return putText(out, slot->text, slot->length);
+}
+
+static char* putDontCare(char* out, int dontCare) {
+    return dontCare ? PUT(out, " (Don't Care)\n") : PUT(out, "\n");
+}
+
+static void makePrefixes(fastFormatType* format, int numMemory) {
+    free(format->prefixes);
+    free(format->prefixEnd);
+    format->prefixes = malloc((size_t)numMemory * 24);
+    format->prefixEnd = malloc((size_t)numMemory * sizeof(int));
+    char* out = format->prefixes;
+    for (int i = 0; i < numMemory; ++i) {
+        out = PUT(out, "\t\tdataMem[ ");
+        out = formatNum(out, i);
+        out = PUT(out, " ] = ");
+        format->prefixEnd[i] = (int)(out - format->prefixes);
+    }
+    format->numPrefixes = numMemory;
+}
+
+// the longest block: 40 bytes per memory line plus the fixed part
+size_t fastStateSize(int numMemory) {
+    return (size_t)numMemory * 40 + 2048;
+}
+
+// the printState block of statePtr at out; returns the end (out needs fastStateSize bytes)
+char* fastFormatState(fastFormatType* format, char* out, stateType* statePtr) {
+    int numMemory = (int)statePtr->numMemory;
+    if (numMemory > format->numPrefixes) {
+        makePrefixes(format, numMemory);
+    }
+    char* prefixes = format->prefixes;
+    int* prefixEnd = format->prefixEnd;
+
+    out = PUT(out, "\n@@@\nstate before cycle ");
+    out = formatNum(out, (int)statePtr->cycles);
+    out = PUT(out, " starts:\n\tpc = ");
+    out = formatNum(out, statePtr->pc);
+    out = PUT(out, "\n\tdata memory:\n");
+    for (int i = 0, start = 0; i < numMemory; start = prefixEnd[i++]) {
+        out = putText(out, prefixes + start, prefixEnd[i] - start);
+        out = formatNum(out, statePtr->dataMem[i]);
+        *out++ = '\n';
+    }
+    out = PUT(out, "\tregisters:\n");
+    for (int i = 0; i < NUMREGS; ++i) {
+        out = PUT(out, "\t\treg[ ");
+        *out++ = (char)('0' + i);
+        out = PUT(out, " ] = ");
+        out = formatNum(out, statePtr->reg[i]);
+        *out++ = '\n';
+    }
+
+    // IF/ID
+    out = PUT(out, "\tIF/ID pipeline register:\n\t\tinstruction = ");
+    out = putInstruction(format, out, statePtr->IFID.instr);
+    out = PUT(out, "\t\tpcPlus1 = ");
+    out = formatNum(out, statePtr->IFID.pcPlus1);
+    out = putDontCare(out, opcode(statePtr->IFID.instr) == NOOP);
+
+    // ID/EX
+    int idexOp = opcode(statePtr->IDEX.instr);
+    out = PUT(out, "\tID/EX pipeline register:\n\t\tinstruction = ");
+    out = putInstruction(format, out, statePtr->IDEX.instr);
+    out = PUT(out, "\t\tpcPlus1 = ");
+    out = formatNum(out, statePtr->IDEX.pcPlus1);
+    out = putDontCare(out, idexOp == NOOP);
+    out = PUT(out, "\t\treadRegA = ");
+    out = formatNum(out, statePtr->IDEX.valA);
+    out = putDontCare(out, idexOp >= HALT || idexOp < 0);
+    out = PUT(out, "\t\treadRegB = ");
+    out = formatNum(out, statePtr->IDEX.valB);
+    out = putDontCare(out, idexOp == LW || idexOp > BEQ || idexOp < 0);
+    out = PUT(out, "\t\toffset = ");
+    out = formatNum(out, statePtr->IDEX.offset);
+    out = putDontCare(out, idexOp != LW && idexOp != SW && idexOp != BEQ);
+
+    // EX/MEM
+    int exmemOp = opcode(statePtr->EXMEM.instr);
+    out = PUT(out, "\tEX/MEM pipeline register:\n\t\tinstruction = ");
+    out = putInstruction(format, out, statePtr->EXMEM.instr);
+    out = PUT(out, "\t\tbranchTarget ");
+    out = formatNum(out, statePtr->EXMEM.branchTarget);
+    out = putDontCare(out, exmemOp != BEQ);
+    out = statePtr->EXMEM.eq ? PUT(out, "\t\teq ? True") : PUT(out, "\t\teq ? False");
+    out = putDontCare(out, exmemOp != BEQ);
+    out = PUT(out, "\t\taluResult = ");
+    out = formatNum(out, statePtr->EXMEM.aluResult);
+    out = putDontCare(out, exmemOp > SW || exmemOp < 0);
+    out = PUT(out, "\t\treadRegB = ");
+    out = formatNum(out, statePtr->EXMEM.valB);
+    out = putDontCare(out, exmemOp != SW);
+
+    // MEM/WB
+    int memwbOp = opcode(statePtr->MEMWB.instr);
+    out = PUT(out, "\tMEM/WB pipeline register:\n\t\tinstruction = ");
+    out = putInstruction(format, out, statePtr->MEMWB.instr);
+    out = PUT(out, "\t\twriteData = ");
+    out = formatNum(out, statePtr->MEMWB.writeData);
+    out = putDontCare(out, memwbOp >= SW || memwbOp < 0);
+
+    // WB/END
+    int wbendOp = opcode(statePtr->WBEND.instr);
+    out = PUT(out, "\tWB/END pipeline register:\n\t\tinstruction = ");
+    out = putInstruction(format, out, statePtr->WBEND.instr);
+    out = PUT(out, "\t\twriteData = ");
+    out = formatNum(out, statePtr->WBEND.writeData);
+    out = putDontCare(out, wbendOp >= SW || wbendOp < 0);
+
+    return PUT(out, "end state\n");
+}
+
+void fastPrintState(stateType* statePtr) {
+    size_t worst = fastStateSize((int)statePtr->numMemory);
+    if (capacity < worst + FASTBUFFER) {
+        fastPrintFlush();
+        free(buffer);
+        capacity = worst + FASTBUFFER;
+        buffer = malloc(capacity);
+    }
+    if (length + worst > capacity) {
+        fastPrintFlush();
+    }
+    length = fastFormatState(&format, buffer + length, statePtr) - buffer;
+}
+
+void fastPrintFlush(void) {
+    fastWrite(buffer, length);
+    length = 0;
+}
+
+// all of text to stdout, bypassing stdio
+void fastWrite(const char* text, size_t size) {
+    for (size_t done = 0; done < size;) {
+        ssize_t wrote = write(STDOUT_FILENO, text + done, size - done);
+        if (wrote < 0) {
+            perror("write");
+            exit(1);
+        }
+        done += (size_t)wrote;
+    }
+}
@@ -0,0 +1,34 @@
+/*
+ * A faster printState: the same bytes, formatted by hand into a large
+ * buffer that goes out with one write() per flush.
+ **/
+
+#ifndef FASTPRINT_H
+#define FASTPRINT_H
+
+#include "pipeline.h"
+
+#define FASTCACHE 1024        // cached instruction texts (power of two)
+#define FASTLINE 64           // longest "word ( disassembly )\n"
+
+typedef struct fastInstrStruct {
+    int instr;
+    int length;                   // 0: empty slot
+    char text[FASTLINE];
+} fastInstrType;
+
+// per-thread formatting state; zero-initialize before use
+typedef struct fastFormatStruct {
+    fastInstrType cache[FASTCACHE];
+    char* prefixes;               // "\t\tdataMem[ i ] = " for every address, back to back
+    int* prefixEnd;               // end of address i's prefix in prefixes
+    int numPrefixes;
+} fastFormatType;
+
+size_t fastStateSize(int);
+char* fastFormatState(fastFormatType*, char*, stateType*);
+void fastPrintState(stateType*);
+void fastPrintFlush(void);
+void fastWrite(const char*, size_t);
+
+#endif
@@ -0,0 +1,176 @@
+/*
+ * Static hazard analysis of LC-2K machine code for the project 3 pipeline.
+ * Lists every load-use pair that costs a stall and every beq that costs
+ * three squashed slots when taken, and estimates the cycles each basic
+ * block takes. With -r the program is also run at the instruction level
+ * to weight the blocks and predict the simulator's total cycle count.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "program.h"
+
+#define BRANCHPENALTY 3   // slots squashed when a beq resolves taken in MEM
+#define PIPELINEFILL 4    // cycles from fetching halt until it reaches MEMWB
+
+typedef struct blockStruct {
+    int start, end;             // instructions [start, end]
+    int stalls;                 // load-use stalls inside the block
+    int entryStall;             // 1 if falling into the block stalls on a lw just before it
+    int endsInBranch;
+    unsigned long long count;   // times executed (-r)
+} blockType;
+
+unsigned long long run(programType*, blockType*, int*, unsigned long long, unsigned long long*);
+
+int main(int argc, char* argv[]) {
+    static programType program;
+    static blockType blocks[NUMMEMORY];
+    static int blockOf[NUMMEMORY];
+    unsigned long long maxSteps = 0;  // -r <steps>: also run the program for at most this many instructions
+
+    int argi = 1;
+    if (argc == 4 && !strcmp(argv[1], "-r")) {
+        maxSteps = strtoull(argv[2], NULL, 10);
+        argi = 3;
+    }
+    if (argc - argi != 1) {
+        printf("error: usage: %s [-r maxSteps] <machine-code file>\n", argv[0]);
+        exit(1);
+    }
+    readProgram(&program, argv[argi]);
+    findBlocks(&program);
+
+    char text[MAXLINELENGTH], text2[MAXLINELENGTH];
+    printf("load-use stalls (1 cycle each):\n");
+    for (int pc = 0; pc < program.numMemory; ++pc) {
+        if (loadUseStall(&program, pc + 1)) {
+            instructionText(program.mem[pc], text);
+            instructionText(program.mem[pc + 1], text2);
+            printf("\tpc %d: %s -> pc %d: %s (reg %d)\n", pc, text, pc + 1, text2, field1(program.mem[pc]));
+        }
+    }
+
+    printf("taken-branch sites (%d squashed slots each):\n", BRANCHPENALTY);
+    for (int pc = 0; pc < program.numMemory; ++pc) {
+        int instr = program.mem[pc];
+        if (program.reachable[pc] && opcode(instr) == BEQ) {
+            instructionText(instr, text);
+            if (field0(instr) == field1(instr)) {
+                printf("\tpc %d: %s -> %d (always taken)\n", pc, text, pc + 1 + convertNum(field2(instr)));
+            } else {
+                printf("\tpc %d: %s -> %d (taken if reg %d == reg %d)\n", pc, text,
+                       pc + 1 + convertNum(field2(instr)), field0(instr), field1(instr));
+            }
+        }
+    }
+
+    int numBlocks = 0;
+    for (int pc = 0; pc < program.numMemory; ++pc) {
+        if (!program.reachable[pc]) {
+            continue;
+        }
+        if (program.leader[pc] || numBlocks == 0) {
+            blocks[numBlocks].start = pc;
+            blocks[numBlocks].stalls = 0;
+            blocks[numBlocks].entryStall = loadUseStall(&program, pc);
+            blocks[numBlocks].count = 0;
+            ++numBlocks;
+        }
+        blockType* block = &blocks[numBlocks - 1];
+        block->end = pc;
+        block->endsInBranch = opcode(program.mem[pc]) == BEQ;
+        if (pc != block->start) {
+            block->stalls += loadUseStall(&program, pc);  // a stall across the start is only on the fall-through edge
+        }
+        blockOf[pc] = numBlocks - 1;
+    }
+
+    unsigned long long predicted = 0, steps = 0;
+    if (maxSteps) {
+        predicted = run(&program, blocks, blockOf, maxSteps, &steps);
+    }
+
+    printf("basic blocks (cycles per execution):\n");
+    for (int i = 0; i < numBlocks; ++i) {
+        blockType* block = &blocks[i];
+        int cycles = block->end - block->start + 1 + block->stalls;
+        printf("\t[%d, %d]\t%d instructions, %d stalls", block->start, block->end,
+               block->end - block->start + 1, block->stalls);
+        if (block->entryStall) {
+            printf(" (+1 when entered by falling through)");
+        }
+        printf(": %d cycles", cycles);
+        if (block->endsInBranch) {
+            printf(" falling through, %d taken", cycles + BRANCHPENALTY);
+        }
+        if (maxSteps) {
+            printf("\texecuted %llu times", block->count);
+        }
+        printf("\n");
+    }
+    if (maxSteps && predicted) {
+        printf("predicted total: %llu cycles for %llu instructions\n", predicted, steps);
+    } else if (maxSteps) {
+        printf("no halt within %llu instructions\n", maxSteps);
+    }
+    return 0;
+}
+
+/*
+ * Execute at the instruction level, counting block executions and the
+ * pipeline's cycles: one per instruction before halt, one per load-use stall,
+ * BRANCHPENALTY per taken beq, and PIPELINEFILL for halt to reach MEMWB.
+ * Returns 0 if the program does not halt within maxSteps.
+ **/
+unsigned long long run(programType* program, blockType* blocks, int* blockOf,
+                       unsigned long long maxSteps, unsigned long long* steps) {
+    static int mem[NUMMEMORY];
+    int reg[NUMREGS] = {0};
+    memcpy(mem, program->mem, sizeof(mem));
+    unsigned long long cycles = 0;
+    int pc = 0, prev = NOOPINSTR;
+    for (*steps = 0; *steps < maxSteps; ++*steps) {
+        if (pc < 0 || pc >= program->numMemory) {
+            return 0;
+        }
+        if (program->reachable[pc] && blocks[blockOf[pc]].start == pc) {
+            ++blocks[blockOf[pc]].count;
+        }
+        int instr = program->mem[pc];
+        int regA = reg[field0(instr)], regB = reg[field1(instr)];
+        int offset = convertNum(field2(instr));
+        if (opcode(prev) == LW && isRegUsed(instr, field1(prev))) {
+            ++cycles;
+        }
+        prev = instr;
+        ++pc;
+        switch (opcode(instr)) {
+            case ADD:
+                reg[field2(instr)] = regA + regB;
+                break;
+            case NOR:
+                reg[field2(instr)] = ~(regA | regB);
+                break;
+            case LW:
+                reg[field1(instr)] = mem[regA + offset];
+                break;
+            case SW:
+                mem[regA + offset] = regB;
+                break;
+            case BEQ:
+                if (regA == regB) {
+                    pc += offset;
+                    cycles += BRANCHPENALTY;
+                    prev = NOOPINSTR;
+                }
+                break;
+            case HALT:
+                return cycles + PIPELINEFILL;
+        }
+        ++cycles;
+    }
+    return 0;
+}
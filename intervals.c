@@ -0,0 +1,358 @@
+/*
+ * Interval-parallel cycle counting for one long LC-2K program.
+ * A functional (ISA-level) pass runs the program once and saves the
+ * architectural state (pc, registers, data memory) every K instructions.
+ * Each interval [s, s + K) is then simulated on the project 3 pipeline by a
+ * worker thread, starting from a drained pipeline W instructions before s
+ * so the pipeline has filled by the time s retires. A worker measures the
+ * cycles between instruction s and instruction s + K entering MEM/WB (the
+ * simulator stops when halt gets there), and the totals of all intervals
+ * add up to the program's cycle count.
+ *
+ * The result is exact for this pipeline: how many cycles separate two
+ * consecutive instructions depends only on that pair (a lw feeding the
+ * next instruction stalls one cycle, a taken beq squashes three), so any
+ * warm-up of one instruction or more reproduces every gap of the full
+ * run. The warm-up is kept configurable for pipelines with longer memory
+ * (caches, predictors); -v checks the total against a serial simulation.
+ *
+ * With -p P only every P-th interval is simulated (SMARTS-style systematic
+ * sampling) and the rest are just fast-forwarded by the functional pass.
+ * The sampled intervals' CPIs give an estimate of the program's CPI and
+ * total cycles with a confidence interval from their spread.
+ **/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipeline.h"
+#include "program.h"
+
+#define MAXTHREADS 64
+
+typedef struct checkpointStruct {
+    int pc;
+    int reg[NUMREGS];
+    int memLength;                   // words of mem saved; the rest are 0
+    int* mem;
+} checkpointType;
+
+typedef struct intervalStruct {
+    unsigned long long warm;         // instruction the worker starts at (its checkpoint)
+    unsigned long long start, end;   // cycles are counted from start to end entering MEM/WB
+    checkpointType checkpoint;
+    unsigned long long cycles;       // result
+    unsigned long long fill;         // cycle start entered MEM/WB, if the worker started at it
+} intervalType;
+
+typedef struct jobStruct {
+    programType* program;
+    intervalType* intervals;
+    int numIntervals;
+    int next;                        // next interval to hand out, taken with an atomic add
+} jobType;
+
+unsigned long long functionalRun(programType*, unsigned long long, unsigned long long, unsigned long long,
+                                 unsigned long long, intervalType**, int*);
+void estimate(intervalType*, int, unsigned long long, unsigned long long, double, unsigned long long);
+void* worker(void*);
+unsigned long long simulateInterval(programType*, intervalType*, stateType*, stateType*);
+
+int main(int argc, char* argv[]) {
+    static programType program;
+    int numThreads = 4;                             // -j <threads>
+    unsigned long long intervalLength = 100000;     // -k <instructions>: K
+    unsigned long long warmup = 8;                  // -w <instructions>: W
+    unsigned long long maxInstrs = 1000000000ull;   // -m <instructions>: give up after this many
+    int verify = 0;                                 // -v: also simulate serially and compare
+    unsigned long long period = 1;                  // -p <P>: only simulate every P-th interval
+    double confidence = 95;                         // -c <percent>: of the sampling estimate (90, 95 or 99)
+
+    int argi = 1;
+    for (; argi < argc - 1 && argv[argi][0] == '-'; ++argi) {
+        if (!strcmp(argv[argi], "-j") && argi + 1 < argc - 1) {
+            numThreads = atoi(argv[++argi]);
+        } else if (!strcmp(argv[argi], "-k") && argi + 1 < argc - 1) {
+            intervalLength = strtoull(argv[++argi], NULL, 10);
+        } else if (!strcmp(argv[argi], "-w") && argi + 1 < argc - 1) {
+            warmup = strtoull(argv[++argi], NULL, 10);
+        } else if (!strcmp(argv[argi], "-m") && argi + 1 < argc - 1) {
+            maxInstrs = strtoull(argv[++argi], NULL, 10);
+        } else if (!strcmp(argv[argi], "-p") && argi + 1 < argc - 1) {
+            period = strtoull(argv[++argi], NULL, 10);
+        } else if (!strcmp(argv[argi], "-c") && argi + 1 < argc - 1) {
+            confidence = atof(argv[++argi]);
+        } else if (!strcmp(argv[argi], "-v")) {
+            verify = 1;
+        } else {
+            break;
+        }
+    }
+    if (argi != argc - 1 || numThreads < 1 || numThreads > MAXTHREADS || intervalLength == 0 || period == 0 ||
+        (confidence != 90 && confidence != 95 && confidence != 99)) {
+        printf("error: usage: %s [-j threads] [-k interval] [-w warmup] [-m maxInstructions] [-p period] [-c 90|95|99] [-v] <machine-code file>\n",
+               argv[0]);
+        exit(1);
+    }
+    if (warmup >= intervalLength) {
+        warmup = intervalLength - 1;  // checkpoints must come in interval order
+    }
+    readProgram(&program, argv[argi]);
+
+    intervalType* intervals;
+    int numIntervals;
+    unsigned long long numInstrs =
+        functionalRun(&program, intervalLength, warmup, period, maxInstrs, &intervals, &numIntervals);
+
+    jobType job = {&program, intervals, numIntervals, 0};
+    pthread_t threads[MAXTHREADS];
+    if (numThreads > numIntervals) {
+        numThreads = numIntervals;
+    }
+    for (int i = 0; i < numThreads; ++i) {
+        if (pthread_create(threads + i, NULL, worker, &job)) {
+            printf("error: can't start worker thread\n");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < numThreads; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    unsigned long long serial = 0;
+    if (verify) {
+        static stateType state;
+        loadMemory(&state, program.mem, program.numMemory);
+        initState(&state);
+        runProgram(&state, 0);
+        serial = state.cycles;
+    }
+
+    if (period > 1) {
+        estimate(intervals, numIntervals, numInstrs, intervalLength, confidence, serial);
+        printf("(%d intervals of %llu, warm-up %llu, on %d threads)\n", numIntervals, intervalLength, warmup,
+               numThreads);
+        return 0;
+    }
+
+    unsigned long long total = intervals[0].fill;
+    for (int i = 0; i < numIntervals; ++i) {
+        total += intervals[i].cycles;
+    }
+    printf("%llu instructions in %d intervals of %llu (warm-up %llu) on %d threads\n", numInstrs, numIntervals,
+           intervalLength, warmup, numThreads);
+    printf("Total of %llu cycles executed\n", total);
+    if (verify) {
+        if (serial != total) {
+            printf("error: serial simulation took %llu cycles\n", serial);
+            exit(1);
+        }
+        printf("serial simulation agrees\n");
+    }
+    return 0;
+}
+
+static void saveCheckpoint(checkpointType* checkpoint, int pc, int* reg, int* mem, int memLength) {
+    checkpoint->pc = pc;
+    memcpy(checkpoint->reg, reg, sizeof(checkpoint->reg));
+    checkpoint->memLength = memLength;
+    checkpoint->mem = malloc((size_t)memLength * sizeof(int));
+    memcpy(checkpoint->mem, mem, (size_t)memLength * sizeof(int));
+}
+
+/*
+ * Run the program at the ISA level with the pipeline's semantics (jalr
+ * does nothing, instructions come from the original image, lw and sw use
+ * data memory) and lay out intervals 0, P, 2P, ..., saving each one's
+ * checkpoint on the way. Returns the number of instructions up to and
+ * including halt.
+ **/
+unsigned long long functionalRun(programType* program, unsigned long long intervalLength,
+                                 unsigned long long warmup, unsigned long long period, unsigned long long maxInstrs,
+                                 intervalType** intervalsPtr, int* numIntervalsPtr) {
+    static int mem[NUMMEMORY];
+    int reg[NUMREGS] = {0};
+    int pc = 0;
+    int memLength = program->numMemory;  // mem beyond this was never written
+    memcpy(mem, program->mem, (size_t)program->numMemory * sizeof(int));
+
+    int capacity = 64, numIntervals = 0;
+    intervalType* intervals = malloc((size_t)capacity * sizeof(intervalType));
+    unsigned long long nextWarm = 0;  // instruction the next interval's checkpoint is taken at
+    unsigned long long count = 0;
+    for (;; ++count) {
+        if (count == nextWarm) {
+            if (numIntervals == capacity) {
+                capacity *= 2;
+                intervals = realloc(intervals, (size_t)capacity * sizeof(intervalType));
+            }
+            intervalType* interval = intervals + numIntervals;
+            interval->start = (unsigned long long)numIntervals * period * intervalLength;
+            interval->end = interval->start + intervalLength;
+            interval->warm = count;
+            saveCheckpoint(&interval->checkpoint, pc, reg, mem, memLength);
+            ++numIntervals;
+            unsigned long long start = (unsigned long long)numIntervals * period * intervalLength;
+            nextWarm = start > warmup ? start - warmup : 0;
+        }
+        if (count == maxInstrs) {
+            printf("error: no halt after %llu instructions (pc = %d)\n", count, pc);
+            exit(1);
+        }
+        if (pc < 0 || pc >= NUMMEMORY) {
+            printf("error: pc %d out of range after %llu instructions\n", pc, count);
+            exit(1);
+        }
+
+        int instr = program->mem[pc++];
+        int regA = reg[field0(instr)], regB = reg[field1(instr)];
+        int offset = convertNum(field2(instr));
+        int op = opcode(instr);
+        if (op == HALT) {
+            break;
+        }
+        if (op == LW || op == SW) {
+            int addr = regA + offset;
+            if (addr < 0 || addr >= NUMMEMORY) {
+                printf("error: address %d out of range at pc %d\n", addr, pc - 1);
+                exit(1);
+            }
+            if (op == LW) {
+                reg[field1(instr)] = mem[addr];
+            } else {
+                mem[addr] = regB;
+                if (addr >= memLength) {
+                    memLength = addr + 1;
+                }
+            }
+        } else if (op == ADD) {
+            reg[field2(instr)] = regA + regB;
+        } else if (op == NOR) {
+            reg[field2(instr)] = ~(regA | regB);
+        } else if (op == BEQ && regA == regB) {
+            pc += offset;
+        }
+    }
+
+    // an interval whose checkpoint was taken but that starts at or after halt has nothing to count
+    while (numIntervals > 1 && intervals[numIntervals - 1].start >= count) {
+        free(intervals[--numIntervals].checkpoint.mem);
+    }
+    if (intervals[numIntervals - 1].end > count) {
+        intervals[numIntervals - 1].end = count;
+    }
+    *intervalsPtr = intervals;
+    *numIntervalsPtr = numIntervals;
+    return count + 1;
+}
+
+void* worker(void* arg) {
+    jobType* job = arg;
+    stateType* a = malloc(sizeof(stateType));
+    stateType* b = malloc(sizeof(stateType));
+    int i;
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->numIntervals) {
+        job->intervals[i].cycles = simulateInterval(job->program, job->intervals + i, a, b);
+    }
+    free(a);
+    free(b);
+    return NULL;
+}
+
+/*
+ * Cycles from interval->start to interval->end entering MEM/WB. Real instructions are told apart from bubbles
+ * and squashed fetches by a valid bit per pipeline register, since a noop
+ * in the program looks just like a bubble.
+ **/
+unsigned long long simulateInterval(programType* program, intervalType* interval, stateType* state,
+                                    stateType* newState) {
+    checkpointType* checkpoint = &interval->checkpoint;
+    memset(state->instrMem, 0, sizeof(state->instrMem));
+    memcpy(state->instrMem, program->mem, (size_t)program->numMemory * sizeof(int));
+    memset(state->dataMem, 0, sizeof(state->dataMem));
+    memcpy(state->dataMem, checkpoint->mem, (size_t)checkpoint->memLength * sizeof(int));
+    state->numMemory = (unsigned int)program->numMemory;
+    initState(state);
+    state->pc = checkpoint->pc;
+    memcpy(state->reg, checkpoint->reg, sizeof(state->reg));
+
+    int valid[3] = {0, 0, 0};  // IFID, IDEX, EXMEM hold a real instruction
+    unsigned long long next = interval->warm;  // the instruction that enters MEM/WB next
+    unsigned long long startCycle = 0;
+    while (1) {
+        cycleInfoType info;
+        simulateCycle(state, newState, &info);
+        int entering = valid[2];
+        if (info.branchTaken) {
+            valid[0] = valid[1] = valid[2] = 0;
+        } else if (info.stall) {
+            valid[2] = valid[1];
+            valid[1] = 0;
+        } else {
+            valid[2] = valid[1];
+            valid[1] = valid[0];
+            valid[0] = 1;
+        }
+        stateType* swap = state;
+        state = newState;
+        newState = swap;
+
+        if (entering) {
+            if (next == interval->start) {
+                startCycle = state->cycles;
+                interval->fill = next == interval->warm ? startCycle : 0;
+            }
+            if (next == interval->end) {
+                return state->cycles - startCycle;
+            }
+            ++next;
+        }
+    }
+}
+
+/*
+ * SMARTS estimate from the sampled intervals: the mean of their CPIs, with
+ * a confidence interval of z * stddev / sqrt(n) (with the finite population
+ * correction, since the intervals are sampled without replacement). The
+ * partial interval at the end is left out of the statistics. Totals add
+ * the pipeline fill before the first instruction reaches MEM/WB, which
+ * interval 0 (always sampled) measures.
+ **/
+void estimate(intervalType* intervals, int numIntervals, unsigned long long numInstrs,
+              unsigned long long intervalLength, double confidence, unsigned long long serial) {
+    double z = confidence == 90 ? 1.645 : confidence == 95 ? 1.960 : 2.576;
+    double sum = 0, sumSquares = 0;
+    int n = 0;
+    for (int i = 0; i < numIntervals; ++i) {
+        if (intervals[i].end - intervals[i].start == intervalLength) {
+            double cpi = (double)intervals[i].cycles / (double)intervalLength;
+            sum += cpi;
+            sumSquares += cpi * cpi;
+            ++n;
+        }
+    }
+    unsigned long long gaps = numInstrs - 1;  // instructions after the first to enter MEM/WB
+    double population = (double)gaps / (double)intervalLength;
+    printf("%llu instructions, %d of %.0f intervals sampled\n", numInstrs, n, ceil(population));
+    if (n < 2) {
+        printf("error: need at least 2 full sampled intervals; use a smaller -k or -p\n");
+        exit(1);
+    }
+    double mean = sum / n;
+    double variance = (sumSquares - n * mean * mean) / (n - 1);
+    double correction = population > n ? 1 - n / population : 0;
+    double halfWidth = z * sqrt((variance > 0 ? variance : 0) * correction / n);
+    double total = (double)intervals[0].fill + mean * (double)gaps;
+    printf("CPI %.4f +- %.4f (%.0f%% confidence)\n", mean, halfWidth, confidence);
+    printf("Estimated total of %.0f +- %.0f cycles\n", total, halfWidth * (double)gaps);
+    if (serial) {
+        double error = (total - (double)serial) / (double)serial * 100;
+        printf("serial simulation took %llu cycles (%+.2f%%, %s the interval)\n", serial, error,
+               fabs(total - (double)serial) <= halfWidth * (double)gaps ? "inside" : "outside");
+    }
+}
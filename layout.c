@@ -0,0 +1,338 @@
+/*
+ * Profile-guided block layout for LC-2K machine code.
+ * Reads the per-beq taken/not-taken counts written by simulator -P and
+ * reorders basic blocks so the hot path falls through. Blocks are chained
+ * greedily along their heaviest edges (Pettis-Hansen): a block that ends in
+ * an always-taken beq can have its target placed right after it, and the
+ * jump disappears; a block that loses its fall-through successor gets an
+ * explicit "beq 0 0" to it. Every beq offset is then recomputed. The data
+ * after the code keeps its addresses. Both programs are simulated on the
+ * pipeline to check they compute the same result and to report the cycles.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipeline.h"
+#include "program.h"
+
+#define ENDHALT 0    // block ends in halt
+#define ENDJUMP 1    // always-taken beq: no fall-through
+#define ENDBRANCH 2  // conditional beq
+#define ENDFALL 3    // runs into the next block
+
+typedef struct blockStruct {
+    int start, end;              // instructions [start, end] in the original program
+    int kind;                    // END*
+    int target;                  // block a beq jumps to
+    int fall;                    // block it falls into, -1 if none
+    unsigned long long count;    // times executed according to the profile
+    int next, prev;              // neighbours in its chain, -1 if none
+    int newStart, newSize;
+} blockType;
+
+typedef struct edgeStruct {
+    int from, to;
+    int isJump;                  // merging it removes a jump instead of keeping a fall-through
+    unsigned long long weight;
+} edgeType;
+
+void readProfile(char*, unsigned long long*, unsigned long long*);
+int findCodeBlocks(programType*, blockType*, int*);
+int compareEdges(const void*, const void*);
+int chainHead(blockType*, int);
+int simulate(programType*, stateType*, unsigned int);
+
+int main(int argc, char* argv[]) {
+    static programType program, original;
+    static blockType blocks[NUMMEMORY];
+    static edgeType edges[NUMMEMORY];
+    static int blockOf[NUMMEMORY], order[NUMMEMORY];
+    static unsigned long long taken[NUMMEMORY], notTaken[NUMMEMORY];
+    static stateType before, after;
+    unsigned int maxCycles = 100000000;  // -m <cycles>: give up simulating after this many cycles
+
+    int argi = 1;
+    if (argc == 6 && !strcmp(argv[1], "-m")) {
+        maxCycles = strtoul(argv[2], NULL, 10);
+        argi = 3;
+    }
+    if (argc - argi != 3) {
+        printf("error: usage: %s [-m maxCycles] <machine-code file> <profile> <output file>\n", argv[0]);
+        exit(1);
+    }
+    readProgram(&program, argv[argi]);
+    readProfile(argv[argi + 1], taken, notTaken);
+    findBlocks(&program);
+    original = program;
+
+    int codeEnd = 0;
+    int numBlocks = findCodeBlocks(&program, blocks, &codeEnd);
+    if (numBlocks < 0) {
+        numBlocks = 0;  // reason already printed; write the program back unchanged
+    }
+    for (int b = 0; b < numBlocks; ++b) {
+        for (int pc = blocks[b].start; pc <= blocks[b].end; ++pc) {
+            blockOf[pc] = b;
+        }
+    }
+
+    // block counts: entry + beq edges in + a plain fall-through from the block before
+    int numEdges = 0;
+    for (int b = 0; b < numBlocks; ++b) {
+        blockType* block = blocks + b;
+        int last = program.mem[block->end];
+        if (block->kind == ENDJUMP || block->kind == ENDBRANCH) {
+            block->target = blockOf[block->end + 1 + convertNum(field2(last))];
+            blocks[block->target].count += taken[block->end];
+        }
+        if (block->kind == ENDBRANCH) {
+            blocks[block->fall].count += notTaken[block->end];
+        }
+    }
+    blocks[0].count += 1;
+    for (int b = 1; b < numBlocks; ++b) {
+        if (blocks[b - 1].kind == ENDFALL) {
+            blocks[b].count += blocks[b - 1].count;
+        }
+    }
+    for (int b = 0; b < numBlocks; ++b) {
+        blockType* block = blocks + b;
+        edgeType* edge = edges + numEdges;
+        edge->from = b;
+        if (block->kind == ENDJUMP && block->target != b) {
+            edge->to = block->target;
+            edge->isJump = 1;
+            edge->weight = taken[block->end];
+            ++numEdges;
+        } else if (block->kind == ENDBRANCH || block->kind == ENDFALL) {
+            edge->to = block->fall;
+            edge->isJump = 0;
+            edge->weight = block->kind == ENDBRANCH ? notTaken[block->end] : block->count;
+            ++numEdges;
+        }
+        block->next = block->prev = -1;
+    }
+
+    // chain blocks along the heaviest edges; the entry block must stay at address 0
+    qsort(edges, numEdges, sizeof(edgeType), compareEdges);
+    for (int i = 0; i < numEdges; ++i) {
+        int from = edges[i].from, to = edges[i].to;
+        if (blocks[from].next < 0 && blocks[to].prev < 0 && to != 0 && chainHead(blocks, from) != to) {
+            blocks[from].next = to;
+            blocks[to].prev = from;
+        }
+    }
+    int numOrdered = 0;
+    for (int b = 0; b < numBlocks; ++b) {
+        if (blocks[b].prev < 0) {
+            for (int c = b; c >= 0; c = blocks[c].next) {
+                order[numOrdered++] = c;
+            }
+        }
+    }
+
+    // sizes and addresses: drop jumps to the next block, add jumps where a fall-through was lost
+    int size = 0;
+    for (int i = 0; i < numOrdered; ++i) {
+        blockType* block = blocks + order[i];
+        int following = i + 1 < numOrdered ? order[i + 1] : -1;
+        block->newStart = size;
+        block->newSize = block->end - block->start + 1;
+        if (block->kind == ENDJUMP && block->target == following) {
+            --block->newSize;
+        } else if (block->fall >= 0 && block->fall != following) {
+            ++block->newSize;
+        }
+        size += block->newSize;
+    }
+    char text[MAXLINELENGTH];
+    if (size > codeEnd) {
+        printf("layout needs %d words but the code has %d; leaving the program unchanged\n", size, codeEnd);
+        numOrdered = 0;
+    }
+    if (numOrdered > 0) {
+        int pc = 0;
+        for (int i = 0; i < numOrdered; ++i) {
+            blockType* block = blocks + order[i];
+            int length = block->end - block->start + 1;
+            int kept = block->newSize < length ? length - 1 : length;
+            for (int k = 0; k < kept; ++k, ++pc) {
+                int instr = original.mem[block->start + k];
+                if (opcode(instr) == BEQ) {
+                    int offset = blocks[block->target].newStart - pc - 1;
+                    instr = (instr & ~0xffff) | (offset & 0xffff);
+                }
+                program.mem[pc] = instr;
+            }
+            if (block->newSize > length) {
+                program.mem[pc] = (BEQ << 22) | ((blocks[block->fall].newStart - pc - 1) & 0xffff);
+                ++pc;
+            }
+        }
+        for (; pc < codeEnd; ++pc) {
+            program.mem[pc] = NOOPINSTR;  // unreachable padding keeps the data where it was
+        }
+
+        printf("block order:\n");
+        for (int i = 0; i < numOrdered; ++i) {
+            blockType* block = blocks + order[i];
+            printf("\t[%d, %d] -> %d\texecuted %llu times", block->start, block->end, block->newStart, block->count);
+            int length = block->end - block->start + 1;
+            if (block->newSize < length) {
+                printf(", jump removed");
+            } else if (block->newSize > length) {
+                printf(", jump to %d added", blocks[block->fall].newStart);
+            }
+            printf("\n");
+        }
+    }
+    for (int b = 0; b < numBlocks; ++b) {
+        int end = blocks[b].end;
+        if (blocks[b].kind == ENDBRANCH && taken[end] > notTaken[end]) {
+            instructionText(original.mem[end], text);
+            printf("\tpc %d: %s taken %llu of %llu times; LC-2K has no inverted beq to make it fall through\n", end,
+                   text, taken[end], taken[end] + notTaken[end]);
+        }
+    }
+
+    int haltedBefore = simulate(&original, &before, maxCycles);
+    int haltedAfter = simulate(&program, &after, maxCycles);
+    if (!haltedBefore) {
+        printf("original program does not halt within %u cycles; output not checked\n", maxCycles);
+    } else {
+        int same = haltedAfter && !memcmp(before.reg, after.reg, sizeof(before.reg));
+        for (int addr = codeEnd; same && addr < NUMMEMORY; ++addr) {
+            same = before.dataMem[addr] == after.dataMem[addr];
+        }
+        if (!same) {
+            printf("laid out program computes a different result; keeping the original\n");
+            program = original;
+        } else if (after.cycles > before.cycles) {
+            printf("laid out program is slower (%u cycles vs %u); keeping the original\n", after.cycles,
+                   before.cycles);
+            program = original;
+        } else {
+            printf("%u cycles -> %u cycles (%u saved)\n", before.cycles, after.cycles, before.cycles - after.cycles);
+        }
+    }
+
+    FILE* outFilePtr = fopen(argv[argi + 2], "w");
+    if (outFilePtr == NULL) {
+        printf("error: can't open file %s\n", argv[argi + 2]);
+        exit(1);
+    }
+    writeProgram(&program, outFilePtr);
+    fclose(outFilePtr);
+    return 0;
+}
+
+void readProfile(char* filename, unsigned long long* taken, unsigned long long* notTaken) {
+    char line[MAXLINELENGTH];
+    FILE* filePtr = fopen(filename, "r");
+    if (filePtr == NULL) {
+        printf("error: can't open file %s\n", filename);
+        exit(1);
+    }
+    for (int lineNum = 1; fgets(line, MAXLINELENGTH, filePtr) != NULL; ++lineNum) {
+        int pc;
+        unsigned long long t, n;
+        if (sscanf(line, "%d %llu %llu", &pc, &t, &n) != 3 || pc < 0 || pc >= NUMMEMORY) {
+            printf("error: bad profile line %d in %s\n", lineNum, filename);
+            exit(1);
+        }
+        taken[pc] = t;
+        notTaken[pc] = n;
+    }
+    fclose(filePtr);
+}
+
+/*
+ * Split the code into blocks. Only programs whose reachable code is one
+ * run from address 0, without jalr, are laid out: anything else would
+ * move data or jump targets we cannot see. Returns the number of blocks,
+ * or -1 if the program has to stay as it is; *codeEnd is the first
+ * address after the code.
+ **/
+int findCodeBlocks(programType* program, blockType* blocks, int* codeEnd) {
+    *codeEnd = 0;
+    for (int pc = 0; pc < program->numMemory; ++pc) {
+        if (program->reachable[pc]) {
+            *codeEnd = pc + 1;
+        }
+    }
+    int numBlocks = 0;
+    for (int pc = 0; pc < *codeEnd; ++pc) {
+        int instr = program->mem[pc];
+        if (!program->reachable[pc]) {
+            printf("code and data are interleaved at %d; leaving the program unchanged\n", pc);
+            return -1;
+        }
+        if (opcode(instr) == JALR) {
+            printf("jalr at %d has targets we cannot see; leaving the program unchanged\n", pc);
+            return -1;
+        }
+        if (opcode(instr) == BEQ) {
+            int target = pc + 1 + convertNum(field2(instr));
+            if (target < 0 || target >= *codeEnd) {
+                printf("beq at %d leaves the code; leaving the program unchanged\n", pc);
+                return -1;
+            }
+        }
+        if (pc == 0 || program->leader[pc] || blocks[numBlocks - 1].kind != ENDFALL) {
+            blocks[numBlocks].start = pc;
+            blocks[numBlocks].count = 0;
+            ++numBlocks;
+        }
+        blockType* block = blocks + numBlocks - 1;
+        block->end = pc;
+        block->fall = pc + 1 < *codeEnd ? numBlocks : -1;
+        if (opcode(instr) == HALT) {
+            block->kind = ENDHALT;
+            block->fall = -1;
+        } else if (opcode(instr) == BEQ) {
+            block->kind = field0(instr) == field1(instr) ? ENDJUMP : ENDBRANCH;
+            if (block->kind == ENDJUMP) {
+                block->fall = -1;
+            }
+        } else {
+            block->kind = ENDFALL;
+        }
+    }
+    for (int b = 0; b < numBlocks; ++b) {
+        if (blocks[b].fall < 0 && (blocks[b].kind == ENDBRANCH || blocks[b].kind == ENDFALL)) {
+            printf("the code runs off its end at %d; leaving the program unchanged\n", blocks[b].end);
+            return -1;
+        }
+    }
+    return numBlocks;
+}
+
+// heaviest first; on a tie keep a fall-through before removing a jump, then program order
+int compareEdges(const void* a, const void* b) {
+    const edgeType* x = a;
+    const edgeType* y = b;
+    if (x->weight != y->weight) {
+        return x->weight < y->weight ? 1 : -1;
+    }
+    if (x->isJump != y->isJump) {
+        return x->isJump - y->isJump;
+    }
+    return x->from - y->from;
+}
+
+int chainHead(blockType* blocks, int b) {
+    while (blocks[b].prev >= 0) {
+        b = blocks[b].prev;
+    }
+    return b;
+}
+
+// run program on the pipeline into state; returns 0 if it does not halt within maxCycles
+int simulate(programType* program, stateType* state, unsigned int maxCycles) {
+    memset(state, 0, sizeof(stateType));
+    loadMemory(state, program->mem, program->numMemory);
+    initState(state);
+    return runProgram(state, maxCycles);
+}
@@ -0,0 +1,112 @@
+/*
+ * LC-2K machine definitions shared by the simulator and the tools that
+ * read or rewrite machine code.
+ **/
+
+#ifndef LC2K_H
+#define LC2K_H
+
+#include <stdio.h>
+
+// Machine Definitions
+#define NUMMEMORY 65536  // maximum number of data words in memory
+#define NUMREGS 8        // number of machine registers
+
+#define ADD 0
+#define NOR 1
+#define LW 2
+#define SW 3
+#define BEQ 4
+#define JALR 5  // will not implemented for Project 3
+#define HALT 6
+#define NOOP 7
+
+#define NOOPINSTR (NOOP << 22)
+
+static inline int opcode(int instruction) {
+    return instruction >> 22;
+}
+
+static inline int field0(int instruction) {
+    return (instruction >> 19) & 0x7;
+}
+
+static inline int field1(int instruction) {
+    return (instruction >> 16) & 0x7;
+}
+
+static inline int field2(int instruction) {
+    return instruction & 0xFFFF;
+}
+
+// convert a 16-bit number into a 32-bit Linux integer
+static inline int convertNum(int num) {
+    return num - ((num & (1 << 15)) ? 1 << 16 : 0);
+}
+
+// does instr read reg? (decides the load-use stall in the ID stage)
+static inline int isRegUsed(int instr, int reg) {
+    int opc = opcode(instr);
+    // printf("===========================%d %d %d\n", field0(instr), field1(instr), reg);
+    switch (opc) {
+        case ADD:
+        case NOR:
+        case BEQ:
+        case SW:
+            // case LW:
+            return field0(instr) == reg || field1(instr) == reg;
+        case LW:
+            return field0(instr) == reg;
+        default:
+            break;
+    }
+    return 0;
+}
+
+// register instr writes, or -1
+static inline int writesReg(int instr) {
+    switch (opcode(instr)) {
+        case ADD:
+        case NOR:
+            return field2(instr);
+        case LW:
+        case JALR:
+            return field1(instr);
+    }
+    return -1;
+}
+
+// write value in decimal at out; returns the end
+static inline char* formatNum(char* out, int value) {
+    char digits[12];
+    int n = 0;
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    do {
+        digits[n++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0) {
+        *out++ = '-';
+    }
+    while (n > 0) {
+        *out++ = digits[--n];
+    }
+    return out;
+}
+
+// the text printInstruction prints for instr
+static inline void instructionText(int instr, char* text) {
+    static const char* names[] = {"add", "nor", "lw", "sw", "beq", "jalr", "halt", "noop"};
+    int op = opcode(instr);
+    if (op == ADD || op == NOR || op == LW || op == SW || op == BEQ) {
+        sprintf(text, "%s %d %d %d", names[op], field0(instr), field1(instr), convertNum(field2(instr)));
+    } else if (op == JALR) {
+        sprintf(text, "%s %d %d", names[op], field0(instr), field1(instr));
+    } else if (op == HALT || op == NOOP) {
+        sprintf(text, "%s", names[op]);
+    } else {
+        sprintf(text, ".fill %d", instr);
+    }
+}
+
+#endif
@@ -0,0 +1,383 @@
+/*
+ * Memory access profiling for sizing caches.
+ * Simulates a program on the project 3 pipeline and records the lw/sw
+ * traffic in the MEM stage and the instruction fetches in IF:
+ *  - how often every data address is read and written,
+ *  - for every lw/sw, whether its addresses stay put, walk with a fixed
+ *    stride or jump around,
+ *  - the LRU stack distance (reuse distance) of every data access and
+ *    every fetch: how many other addresses were touched since the last
+ *    access to the same one. A fully-associative LRU cache of C words hits
+ *    exactly the accesses with distance < C, so the cumulative histogram
+ *    is the hit rate of every cache size at once.
+ * Distances come from Olken's algorithm: each address's latest access
+ * marks its time in a Fenwick tree, and the distance is the number of
+ * marks after it, found in O(log n). The time axis is compacted when it
+ * fills up, so long runs need no more memory than short ones.
+ * A stalled fetch is repeated next cycle and is only counted once; fetches
+ * squashed by a taken beq are counted, as a cache would see them.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipeline.h"
+#include "program.h"
+
+#define NUMBUCKETS 18          // distance 0, then [2^(k-1), 2^k) for k = 1..16, then cold
+#define COLDBUCKET (NUMBUCKETS - 1)
+#define REUSETIMES (1u << 20)  // time axis length before it is compacted; must exceed NUMMEMORY
+
+#define CLASSSINGLE 0     // executed once
+#define CLASSSHORT 1      // too few accesses to tell
+#define CLASSCONSTANT 2   // the same address every time
+#define CLASSSTRIDED 3    // a fixed nonzero stride
+#define CLASSIRREGULAR 4
+
+// One access stream (data or instructions) and its reuse distances
+typedef struct reuseStruct {
+    const char* name;
+    unsigned int last[NUMMEMORY];  // time of the address's latest access, 0 if none yet
+    unsigned int* owner;           // address accessed at each time
+    unsigned int* tree;            // Fenwick tree: 1 at the time of every address's latest access
+    unsigned int now;              // times 1..now are in use
+    unsigned long long accesses;
+    unsigned long long histogram[NUMBUCKETS];
+} reuseType;
+
+// The addresses one lw or sw accessed
+typedef struct strideStruct {
+    unsigned long long count;
+    unsigned long long repeats;    // accesses whose stride equals the one before
+    int lastAddr, lastStride;
+    int stride;                    // latest stride that repeated
+} strideType;
+
+typedef struct profileStruct {
+    reuseType data, instr;
+    unsigned long long reads[NUMMEMORY], writes[NUMMEMORY];
+    strideType strides[NUMMEMORY];
+} profileType;
+
+const char* classNames[] = {"single", "short", "constant", "strided", "irregular"};
+
+void reuseInit(reuseType*, const char*);
+void reuseAccess(reuseType*, int);
+void reuseCompact(reuseType*);
+void strideAccess(strideType*, int);
+int strideClass(strideType*);
+void bucketRange(int, char*);
+void printReport(profileType*, programType*, int);
+void writeCsv(profileType*, programType*, char*);
+
+int main(int argc, char* argv[]) {
+    static programType program;
+    static profileType profile;
+    static stateType states[2];
+    unsigned int maxCycles = 100000000;  // -m <cycles>: stop profiling after this many cycles
+    int top = 10;                        // -t <n>: addresses listed in the report
+    char* csvPrefix = NULL;              // -o <prefix>: also write <prefix>.addr.csv, .pc.csv and .reuse.csv
+
+    int argi = 1;
+    for (; argi < argc - 1 && argv[argi][0] == '-'; ++argi) {
+        if (!strcmp(argv[argi], "-m") && argi + 1 < argc - 1) {
+            maxCycles = strtoul(argv[++argi], NULL, 10);
+        } else if (!strcmp(argv[argi], "-t") && argi + 1 < argc - 1) {
+            top = atoi(argv[++argi]);
+        } else if (!strcmp(argv[argi], "-o") && argi + 1 < argc - 1) {
+            csvPrefix = argv[++argi];
+        } else {
+            break;
+        }
+    }
+    if (argi != argc - 1 || top < 0) {
+        printf("error: usage: %s [-m maxCycles] [-t top] [-o csvPrefix] <machine-code file>\n", argv[0]);
+        exit(1);
+    }
+    readProgram(&program, argv[argi]);
+    reuseInit(&profile.data, "data");
+    reuseInit(&profile.instr, "instruction");
+
+    stateType* state = &states[0];
+    stateType* newState = &states[1];
+    loadMemory(state, program.mem, program.numMemory);
+    initState(state);
+    int exPc = -1, memPc = -1;  // pc of the instruction in EX and MEM (pipeline registers only carry pc + 1)
+    while (opcode(state->MEMWB.instr) != HALT && state->cycles < maxCycles) {
+        cycleInfoType info;
+        exPc = state->IDEX.pcPlus1 - 1;
+        simulateCycle(state, newState, &info);
+
+        if (!info.stall && (unsigned int)state->pc < NUMMEMORY) {
+            reuseAccess(&profile.instr, state->pc);
+        }
+        int op = opcode(info.memInstr);
+        if ((op == LW || op == SW) && (unsigned int)info.memAddr < NUMMEMORY) {
+            if (op == LW) {
+                ++profile.reads[info.memAddr];
+            } else {
+                ++profile.writes[info.memAddr];
+            }
+            reuseAccess(&profile.data, info.memAddr);
+            if ((unsigned int)memPc < NUMMEMORY) {
+                strideAccess(&profile.strides[memPc], info.memAddr);
+            }
+        }
+        memPc = exPc;
+
+        stateType* swap = state;
+        state = newState;
+        newState = swap;
+    }
+    if (opcode(state->MEMWB.instr) != HALT) {
+        printf("stopped after %u cycles without halting\n", state->cycles);
+    }
+
+    printReport(&profile, &program, top);
+    if (csvPrefix) {
+        writeCsv(&profile, &program, csvPrefix);
+    }
+    return 0;
+}
+
+void reuseInit(reuseType* reuse, const char* name) {
+    reuse->name = name;
+    reuse->owner = malloc((REUSETIMES + 1) * sizeof(unsigned int));
+    reuse->tree = calloc(REUSETIMES + 1, sizeof(unsigned int));
+}
+
+static void treeAdd(reuseType* reuse, unsigned int time, int delta) {
+    for (; time <= REUSETIMES; time += time & -time) {
+        reuse->tree[time] += (unsigned int)delta;
+    }
+}
+
+// latest accesses at times 1..time
+static unsigned int treeCount(reuseType* reuse, unsigned int time) {
+    unsigned int count = 0;
+    for (; time > 0; time -= time & -time) {
+        count += reuse->tree[time];
+    }
+    return count;
+}
+
+void reuseAccess(reuseType* reuse, int addr) {
+    if (reuse->now == REUSETIMES) {
+        reuseCompact(reuse);
+    }
+    unsigned int time = ++reuse->now;
+    unsigned int previous = reuse->last[addr];
+    int bucket = COLDBUCKET;
+    if (previous) {
+        // every address touched since has its latest access after previous
+        unsigned int distance = treeCount(reuse, time - 1) - treeCount(reuse, previous);
+        bucket = 0;
+        while (distance) {
+            ++bucket;
+            distance >>= 1;
+        }
+        treeAdd(reuse, previous, -1);
+    }
+    ++reuse->histogram[bucket];
+    ++reuse->accesses;
+    treeAdd(reuse, time, 1);
+    reuse->last[addr] = time;
+    reuse->owner[time] = (unsigned int)addr;
+}
+
+// renumber the latest accesses 1..n in order and rebuild the tree
+void reuseCompact(reuseType* reuse) {
+    unsigned int n = 0;
+    for (unsigned int time = 1; time <= reuse->now; ++time) {
+        unsigned int addr = reuse->owner[time];
+        if (reuse->last[addr] == time) {
+            reuse->owner[++n] = addr;
+            reuse->last[addr] = n;
+        }
+    }
+    memset(reuse->tree, 0, (REUSETIMES + 1) * sizeof(unsigned int));
+    for (unsigned int time = 1; time <= n; ++time) {
+        reuse->tree[time] = 1;
+    }
+    for (unsigned int time = 1; time <= REUSETIMES; ++time) {
+        unsigned int parent = time + (time & -time);
+        if (parent <= REUSETIMES) {
+            reuse->tree[parent] += reuse->tree[time];
+        }
+    }
+    reuse->now = n;
+}
+
+void strideAccess(strideType* stride, int addr) {
+    if (stride->count) {
+        int current = addr - stride->lastAddr;
+        if (stride->count >= 2 && current == stride->lastStride) {
+            ++stride->repeats;
+            stride->stride = current;
+        }
+        stride->lastStride = current;
+    }
+    stride->lastAddr = addr;
+    ++stride->count;
+}
+
+// CLASS*: a stride is regular if at least 3/4 of the strides repeat the one before
+int strideClass(strideType* stride) {
+    if (stride->count == 1) {
+        return CLASSSINGLE;
+    }
+    if (stride->count < 3) {
+        return CLASSSHORT;
+    }
+    if (stride->repeats * 4 < (stride->count - 2) * 3) {
+        return CLASSIRREGULAR;
+    }
+    return stride->stride ? CLASSSTRIDED : CLASSCONSTANT;
+}
+
+// the distances a histogram bucket holds
+void bucketRange(int bucket, char* text) {
+    if (bucket == COLDBUCKET) {
+        strcpy(text, "cold");
+    } else if (bucket <= 1) {
+        sprintf(text, "%d", bucket);
+    } else {
+        sprintf(text, "%d-%d", 1 << (bucket - 1), (1 << bucket) - 1);
+    }
+}
+
+void printReport(profileType* profile, programType* program, int top) {
+    unsigned long long reads = 0, writes = 0;
+    int touched = 0;
+    for (int addr = 0; addr < NUMMEMORY; ++addr) {
+        reads += profile->reads[addr];
+        writes += profile->writes[addr];
+        touched += profile->reads[addr] || profile->writes[addr];
+    }
+    printf("data: %llu reads, %llu writes to %d addresses\n", reads, writes, touched);
+
+    // the top addresses by accesses, lowest address first among equals
+    static int order[NUMMEMORY];
+    int numOrder = 0;
+    for (int addr = 0; addr < NUMMEMORY && top > 0; ++addr) {
+        unsigned long long total = profile->reads[addr] + profile->writes[addr];
+        if (!total) {
+            continue;
+        }
+        int i = numOrder < top ? numOrder++ : top;  // top: it falls off the end unless it beats the last
+        while (i > 0 && profile->reads[order[i - 1]] + profile->writes[order[i - 1]] < total) {
+            if (i < top) {
+                order[i] = order[i - 1];
+            }
+            --i;
+        }
+        if (i < top) {
+            order[i] = addr;
+        }
+    }
+    if (numOrder) {
+        printf("\taddress\t\treads\t\twrites\n");
+    }
+    for (int i = 0; i < numOrder; ++i) {
+        printf("\t%d\t\t%llu\t\t%llu\n", order[i], profile->reads[order[i]], profile->writes[order[i]]);
+    }
+
+    printf("lw/sw address patterns:\n");
+    char text[MAXLINELENGTH];
+    for (int pc = 0; pc < NUMMEMORY; ++pc) {
+        strideType* stride = &profile->strides[pc];
+        if (!stride->count) {
+            continue;
+        }
+        int class = strideClass(stride);
+        instructionText(pc < program->numMemory ? program->mem[pc] : 0, text);
+        printf("\t%d: %s\t%llu accesses, %s", pc, text, stride->count, classNames[class]);
+        if (class == CLASSSTRIDED) {
+            printf(" %d", stride->stride);
+        }
+        printf("\n");
+    }
+
+    reuseType* streams[2] = {&profile->data, &profile->instr};
+    for (int s = 0; s < 2; ++s) {
+        reuseType* reuse = streams[s];
+        printf("%s reuse distances (%llu accesses, %llu addresses):\n", reuse->name, reuse->accesses,
+               reuse->histogram[COLDBUCKET]);
+        if (!reuse->accesses) {
+            continue;
+        }
+        printf("\tdistance\taccesses\tLRU hit rate at size\n");
+        unsigned long long hits = 0;
+        for (int bucket = 0; bucket < NUMBUCKETS; ++bucket) {
+            if (!reuse->histogram[bucket]) {
+                continue;
+            }
+            bucketRange(bucket, text);
+            printf("\t%s\t\t%llu", text, reuse->histogram[bucket]);
+            if (bucket != COLDBUCKET) {
+                hits += reuse->histogram[bucket];
+                printf("\t\t%.2f%% at %d words", 100.0 * (double)hits / (double)reuse->accesses, 1 << bucket);
+            }
+            printf("\n");
+        }
+    }
+}
+
+static FILE* openCsv(char* prefix, char* suffix) {
+    char filename[MAXLINELENGTH];
+    snprintf(filename, sizeof(filename), "%s%s", prefix, suffix);
+    FILE* file = fopen(filename, "w");
+    if (file == NULL) {
+        printf("error: can't open file %s\n", filename);
+        exit(1);
+    }
+    return file;
+}
+
+void writeCsv(profileType* profile, programType* program, char* prefix) {
+    FILE* file = openCsv(prefix, ".addr.csv");
+    fprintf(file, "address,reads,writes\n");
+    for (int addr = 0; addr < NUMMEMORY; ++addr) {
+        if (profile->reads[addr] || profile->writes[addr]) {
+            fprintf(file, "%d,%llu,%llu\n", addr, profile->reads[addr], profile->writes[addr]);
+        }
+    }
+    fclose(file);
+
+    file = openCsv(prefix, ".pc.csv");
+    fprintf(file, "pc,instruction,accesses,class,stride\n");
+    char text[MAXLINELENGTH];
+    for (int pc = 0; pc < NUMMEMORY; ++pc) {
+        strideType* stride = &profile->strides[pc];
+        if (stride->count) {
+            int class = strideClass(stride);
+            instructionText(pc < program->numMemory ? program->mem[pc] : 0, text);
+            fprintf(file, "%d,%s,%llu,%s,%d\n", pc, text, stride->count, classNames[class],
+                    class == CLASSSTRIDED ? stride->stride : 0);
+        }
+    }
+    fclose(file);
+
+    file = openCsv(prefix, ".reuse.csv");
+    fprintf(file, "stream,distance,accesses,lru_words,lru_hit_rate\n");
+    reuseType* streams[2] = {&profile->data, &profile->instr};
+    for (int s = 0; s < 2; ++s) {
+        unsigned long long hits = 0;
+        for (int bucket = 0; bucket < NUMBUCKETS; ++bucket) {
+            bucketRange(bucket, text);
+            fprintf(file, "%s,%s,%llu", streams[s]->name, text, streams[s]->histogram[bucket]);
+            if (bucket == COLDBUCKET) {
+                fprintf(file, ",,\n");
+                continue;
+            }
+            hits += streams[s]->histogram[bucket];
+            fprintf(file, ",%d,%.6f\n", 1 << bucket,
+                    streams[s]->accesses ? (double)hits / (double)streams[s]->accesses : 0.0);
+        }
+    }
+    if (fclose(file)) {
+        printf("error in writing %s.reuse.csv\n", prefix);
+        exit(1);
+    }
+}
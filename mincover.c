@@ -0,0 +1,166 @@
+/*
+ * Test-suite minimization from hazard coverage files (simulator -H).
+ * Each file lists how often a program exercised every forwarding path,
+ * load-use stall and branch outcome. This reports which events the whole
+ * suite covers and never covers, and finds a smallest subset of the
+ * programs that covers the same events: a greedy cover gives the first
+ * bound, then an exact set-cover search (branching on the programs that
+ * cover the first uncovered event) improves it.
+ **/
+
+#define _POSIX_C_SOURCE 200809L  // strdup
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAXEVENTS 64
+#define MAXTESTS 256
+#define MAXNAMELENGTH 128
+
+typedef struct suiteStruct {
+    int numEvents, numTests;
+    char events[MAXEVENTS][MAXNAMELENGTH];
+    char* tests[MAXTESTS];                // file names without ".cov"
+    unsigned long long covers[MAXTESTS];  // bit e: the test exercised event e
+} suiteType;
+
+typedef struct searchStruct {
+    suiteType* suite;
+    unsigned long long goal;              // events covered by the whole suite
+    int chosen[MAXTESTS], numChosen;
+    int best[MAXTESTS], numBest;
+} searchType;
+
+void readCoverage(suiteType*, char*);
+int greedyCover(suiteType*, unsigned long long, int*);
+void exactCover(searchType*, unsigned long long);
+
+int main(int argc, char* argv[]) {
+    static suiteType suite;
+    static searchType search;
+    int listOnly = 0;  // -l: only print the programs of the subset, one per line
+
+    int argi = 1;
+    if (argc > 1 && !strcmp(argv[1], "-l")) {
+        listOnly = 1;
+        ++argi;
+    }
+    if (argi >= argc) {
+        printf("error: usage: %s [-l] <coverage file> ...\n", argv[0]);
+        exit(1);
+    }
+    for (; argi < argc; ++argi) {
+        readCoverage(&suite, argv[argi]);
+    }
+
+    unsigned long long goal = 0;
+    for (int t = 0; t < suite.numTests; ++t) {
+        goal |= suite.covers[t];
+    }
+    search.suite = &suite;
+    search.goal = goal;
+    search.numBest = greedyCover(&suite, goal, search.best);
+    exactCover(&search, 0);
+
+    if (listOnly) {
+        for (int i = 0; i < search.numBest; ++i) {
+            printf("%s\n", suite.tests[search.best[i]]);
+        }
+        return 0;
+    }
+    int numCovered = __builtin_popcountll(goal);
+    printf("%d of %d events covered by %d programs\n", numCovered, suite.numEvents, suite.numTests);
+    for (int e = 0; e < suite.numEvents; ++e) {
+        if (!(goal >> e & 1)) {
+            printf("\tnever: %s\n", suite.events[e]);
+        }
+    }
+    printf("%d programs cover the same events:\n", search.numBest);
+    for (int i = 0; i < search.numBest; ++i) {
+        int t = search.best[i];
+        printf("\t%s (%d events)\n", suite.tests[t], __builtin_popcountll(suite.covers[t]));
+    }
+    return 0;
+}
+
+// add one program's "count event" lines to the suite
+void readCoverage(suiteType* suite, char* filename) {
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        printf("error: can't open file %s\n", filename);
+        exit(1);
+    }
+    if (suite->numTests == MAXTESTS) {
+        printf("error: more than %d coverage files\n", MAXTESTS);
+        exit(1);
+    }
+    int t = suite->numTests++;
+    suite->tests[t] = strdup(filename);
+    size_t length = strlen(filename);
+    if (length > 4 && !strcmp(filename + length - 4, ".cov")) {
+        suite->tests[t][length - 4] = '\0';
+    }
+
+    unsigned long long count;
+    char name[MAXNAMELENGTH];
+    while (fscanf(file, "%llu %127[^\n]", &count, name) == 2) {
+        int e = 0;
+        while (e < suite->numEvents && strcmp(suite->events[e], name)) {
+            ++e;
+        }
+        if (e == suite->numEvents) {
+            if (e == MAXEVENTS) {
+                printf("error: more than %d coverage events\n", MAXEVENTS);
+                exit(1);
+            }
+            strcpy(suite->events[suite->numEvents++], name);
+        }
+        if (count) {
+            suite->covers[t] |= 1ull << e;
+        }
+    }
+    fclose(file);
+}
+
+// repeatedly take the program adding the most uncovered events; returns how many it took
+int greedyCover(suiteType* suite, unsigned long long goal, int* chosen) {
+    unsigned long long covered = 0;
+    int numChosen = 0;
+    while (covered != goal) {
+        int best = 0, bestGain = -1;
+        for (int t = 0; t < suite->numTests; ++t) {
+            int gain = __builtin_popcountll(suite->covers[t] & ~covered);
+            if (gain > bestGain) {
+                best = t;
+                bestGain = gain;
+            }
+        }
+        chosen[numChosen++] = best;
+        covered |= suite->covers[best];
+    }
+    return numChosen;
+}
+
+// every cover has a program with the lowest uncovered event, so branching on those finds the smallest
+void exactCover(searchType* search, unsigned long long covered) {
+    if (covered == search->goal) {
+        if (search->numChosen < search->numBest) {
+            search->numBest = search->numChosen;
+            memcpy(search->best, search->chosen, search->numChosen * sizeof(int));
+        }
+        return;
+    }
+    if (search->numChosen + 1 >= search->numBest) {
+        return;
+    }
+    unsigned long long event = (search->goal & ~covered) & -(search->goal & ~covered);
+    suiteType* suite = search->suite;
+    for (int t = 0; t < suite->numTests; ++t) {
+        if (suite->covers[t] & event) {
+            search->chosen[search->numChosen++] = t;
+            exactCover(search, covered | suite->covers[t]);
+            --search->numChosen;
+        }
+    }
+}
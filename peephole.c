@@ -0,0 +1,347 @@
+/*
+ * Peephole optimizer for LC-2K machine code.
+ * Rewrites single instructions in place using a table of rules backed by
+ * two dataflow analyses over the control-flow graph: which registers
+ * hold a copy of which memory word, and which registers are live. An
+ * instruction is only ever replaced by one instruction (usually a noop),
+ * so the .fill data and every beq offset stay where they were. Both
+ * programs are then simulated on the pipeline, and the rewrite is kept
+ * only if the final state matches and it takes no more cycles.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipeline.h"
+#include "program.h"
+
+#define UNKNOWN -1   // register holds no known memory word
+#define UNVISITED -2 // dataflow has not reached this instruction yet
+#define ALLREGS ((1 << NUMREGS) - 1)
+
+typedef struct analysisStruct {
+    int reg0Written;               // some reachable instruction writes reg 0
+    int hasJalr;                   // indirect jumps: give up on dataflow
+    int holds[NUMMEMORY][NUMREGS]; // before each pc: address whose word each reg holds
+    unsigned char liveOut[NUMMEMORY];
+} analysisType;
+
+typedef struct ruleStruct {
+    const char* name;
+    int (*rewrite)(programType*, analysisType*, int);  // replacement for the instruction at pc, or -1
+    int count;
+} ruleType;
+
+void analyze(programType*, analysisType*);
+int successors(programType*, int, int*);
+void transfer(int, int*);
+int branchToNext(programType*, analysisType*, int);
+int selfAdd(programType*, analysisType*, int);
+int redundantLoad(programType*, analysisType*, int);
+int loadToCopy(programType*, analysisType*, int);
+int redundantStore(programType*, analysisType*, int);
+int deadWrite(programType*, analysisType*, int);
+int simulate(programType*, stateType*, unsigned int);
+
+// each rule runs over the whole program on a fresh analysis, so rules never act on each other's stale facts
+ruleType rules[] = {
+    {"branch to next", branchToNext, 0},       // beq a b 0 -> noop
+    {"self add", selfAdd, 0},                  // add r 0 r -> noop
+    {"redundant load", redundantLoad, 0},      // lw 0 r X when r already holds mem[X] -> noop
+    {"load to copy", loadToCopy, 0},           // lw 0 r X when s holds mem[X] -> add s 0 r
+    {"redundant store", redundantStore, 0},    // sw 0 r X when r already holds mem[X] -> noop
+    {"dead write", deadWrite, 0},              // result overwritten before it is read -> noop
+};
+
+int main(int argc, char* argv[]) {
+    static programType program, original;
+    static analysisType analysis;
+    static stateType before, after;
+    unsigned int maxCycles = 100000000;  // -m <cycles>: give up simulating after this many cycles
+
+    int argi = 1;
+    if (argc == 5 && !strcmp(argv[1], "-m")) {
+        maxCycles = strtoul(argv[2], NULL, 10);
+        argi = 3;
+    }
+    if (argc - argi != 2) {
+        printf("error: usage: %s [-m maxCycles] <machine-code file> <output file>\n", argv[0]);
+        exit(1);
+    }
+    readProgram(&program, argv[argi]);
+    findBlocks(&program);
+    original = program;
+
+    int numRules = sizeof(rules) / sizeof(rules[0]);
+    for (int changed = 1; changed;) {
+        changed = 0;
+        for (int i = 0; i < numRules; ++i) {
+            analyze(&program, &analysis);
+            for (int pc = 0; pc < program.numMemory; ++pc) {
+                if (!program.reachable[pc]) {
+                    continue;
+                }
+                int instr = rules[i].rewrite(&program, &analysis, pc);
+                if (instr >= 0 && instr != program.mem[pc]) {
+                    program.mem[pc] = instr;
+                    ++rules[i].count;
+                    changed = 1;
+                }
+            }
+        }
+    }
+
+    char text[MAXLINELENGTH];
+    for (int pc = 0; pc < program.numMemory; ++pc) {
+        if (program.mem[pc] != original.mem[pc]) {
+            instructionText(original.mem[pc], text);
+            printf("\tpc %d: %s", pc, text);
+            instructionText(program.mem[pc], text);
+            printf(" -> %s\n", text);
+        }
+    }
+    for (int i = 0; i < numRules; ++i) {
+        printf("%s: %d\n", rules[i].name, rules[i].count);
+    }
+
+    int haltedBefore = simulate(&original, &before, maxCycles);
+    int haltedAfter = simulate(&program, &after, maxCycles);
+    if (!haltedBefore) {
+        printf("original program does not halt within %u cycles; output not checked\n", maxCycles);
+    } else {
+        int same = haltedAfter && !memcmp(before.reg, after.reg, sizeof(before.reg));
+        for (int addr = 0; same && addr < NUMMEMORY; ++addr) {
+            // rewritten code words are expected to differ, data must not
+            if (addr >= program.numMemory || program.mem[addr] == original.mem[addr]) {
+                same = before.dataMem[addr] == after.dataMem[addr];
+            }
+        }
+        if (!same) {
+            printf("optimized program computes a different result; keeping the original\n");
+            program = original;
+        } else if (after.cycles > before.cycles) {
+            printf("optimized program is slower (%u cycles vs %u); keeping the original\n", after.cycles,
+                   before.cycles);
+            program = original;
+        } else {
+            printf("%u cycles -> %u cycles (%u saved)\n", before.cycles, after.cycles, before.cycles - after.cycles);
+        }
+    }
+
+    FILE* outFilePtr = fopen(argv[argi + 1], "w");
+    if (outFilePtr == NULL) {
+        printf("error: can't open file %s\n", argv[argi + 1]);
+        exit(1);
+    }
+    writeProgram(&program, outFilePtr);
+    fclose(outFilePtr);
+    return 0;
+}
+
+/*
+ * Forward: for each register, the address of the memory word it is known
+ * to hold a copy of (loaded with lw 0 r X or stored with sw 0 r X and not
+ * clobbered since). Backward: the registers whose value may still be read;
+ * every register is live at halt because the final state is the result.
+ **/
+void analyze(programType* program, analysisType* analysis) {
+    static int work[NUMMEMORY], queued[NUMMEMORY];
+    static unsigned char liveIn[NUMMEMORY];
+    int n = program->numMemory, next[2];
+
+    analysis->reg0Written = analysis->hasJalr = 0;
+    for (int pc = 0; pc < n; ++pc) {
+        if (program->reachable[pc]) {
+            analysis->reg0Written |= writesReg(program->mem[pc]) == 0;
+            analysis->hasJalr |= opcode(program->mem[pc]) == JALR;
+        }
+        for (int r = 0; r < NUMREGS; ++r) {
+            analysis->holds[pc][r] = UNVISITED;
+        }
+        analysis->liveOut[pc] = ALLREGS;
+        liveIn[pc] = ALLREGS;
+        queued[pc] = 0;
+    }
+    if (analysis->hasJalr || analysis->reg0Written) {
+        // without a fixed reg 0 or a known control-flow graph nothing below is sound
+        for (int pc = 0; pc < n; ++pc) {
+            for (int r = 0; r < NUMREGS; ++r) {
+                analysis->holds[pc][r] = UNKNOWN;
+            }
+        }
+        return;
+    }
+
+    int numWork = 0;
+    for (int r = 0; r < NUMREGS; ++r) {
+        analysis->holds[0][r] = UNKNOWN;
+    }
+    work[numWork++] = 0;
+    queued[0] = 1;
+    while (numWork > 0) {
+        int pc = work[--numWork];
+        queued[pc] = 0;
+        int holds[NUMREGS];
+        memcpy(holds, analysis->holds[pc], sizeof(holds));
+        transfer(program->mem[pc], holds);
+        int numNext = successors(program, pc, next);
+        for (int i = 0; i < numNext; ++i) {
+            int* target = analysis->holds[next[i]];
+            int changed = 0;
+            for (int r = 0; r < NUMREGS; ++r) {
+                int merged = target[r] == UNVISITED || target[r] == holds[r] ? holds[r] : UNKNOWN;
+                changed |= merged != target[r];
+                target[r] = merged;
+            }
+            if (changed && !queued[next[i]]) {
+                work[numWork++] = next[i];
+                queued[next[i]] = 1;
+            }
+        }
+    }
+
+    // liveness: iterate backwards to a fixed point, starting from nothing live
+    for (int pc = 0; pc < n; ++pc) {
+        liveIn[pc] = 0;
+    }
+    for (int changed = 1; changed;) {
+        changed = 0;
+        for (int pc = n - 1; pc >= 0; --pc) {
+            if (!program->reachable[pc]) {
+                continue;
+            }
+            int instr = program->mem[pc];
+            int numNext = successors(program, pc, next);
+            unsigned char out = 0;
+            int alwaysTaken = opcode(instr) == BEQ && field0(instr) == field1(instr);
+            if (numNext == 0 || (pc + 1 >= n && !alwaysTaken)) {
+                out = ALLREGS;  // halt, or leaving the program
+            }
+            for (int i = 0; i < numNext; ++i) {
+                out |= liveIn[next[i]];
+            }
+            unsigned char in = out;
+            if (writesReg(instr) >= 0) {
+                in &= ~(1 << writesReg(instr));
+            }
+            for (int r = 0; r < NUMREGS; ++r) {
+                if (isRegUsed(instr, r)) {
+                    in |= 1 << r;
+                }
+            }
+            changed |= in != liveIn[pc] || out != analysis->liveOut[pc];
+            liveIn[pc] = in;
+            analysis->liveOut[pc] = out;
+        }
+    }
+}
+
+// pcs that can follow pc; returns how many
+int successors(programType* program, int pc, int* next) {
+    int instr = program->mem[pc], numNext = 0;
+    if (opcode(instr) == HALT) {
+        return 0;
+    }
+    if (opcode(instr) == BEQ) {
+        int target = pc + 1 + convertNum(field2(instr));
+        if (target >= 0 && target < program->numMemory) {
+            next[numNext++] = target;
+        }
+        if (field0(instr) == field1(instr)) {
+            return numNext;
+        }
+    }
+    if (pc + 1 < program->numMemory && (numNext == 0 || next[0] != pc + 1)) {
+        next[numNext++] = pc + 1;
+    }
+    return numNext;
+}
+
+// update which memory word each register holds across instr
+void transfer(int instr, int* holds) {
+    int op = opcode(instr), a = field0(instr), b = field1(instr);
+    int offset = convertNum(field2(instr));
+    if (op == SW) {
+        for (int r = 0; r < NUMREGS; ++r) {
+            if (a != 0 || holds[r] == offset) {
+                holds[r] = UNKNOWN;  // a store through a register may alias anything
+            }
+        }
+        if (a == 0 && offset >= 0) {
+            holds[b] = offset;
+        }
+        return;
+    }
+    int dest = writesReg(instr);
+    if (dest < 0) {
+        return;
+    }
+    if (op == LW && a == 0 && offset >= 0) {
+        holds[dest] = offset;
+    } else if (op == ADD && field2(instr) == dest && (a == 0 || b == 0)) {
+        holds[dest] = holds[a == 0 ? b : a];  // a copy: add r 0 d
+    } else {
+        holds[dest] = UNKNOWN;
+    }
+}
+
+int branchToNext(programType* program, analysisType* analysis, int pc) {
+    int instr = program->mem[pc];
+    return opcode(instr) == BEQ && convertNum(field2(instr)) == 0 ? NOOPINSTR : -1;
+}
+
+int selfAdd(programType* program, analysisType* analysis, int pc) {
+    int instr = program->mem[pc];
+    int a = field0(instr), b = field1(instr), dest = field2(instr);
+    if (opcode(instr) != ADD || analysis->reg0Written || dest == 0) {
+        return -1;
+    }
+    return (a == 0 && b == dest) || (b == 0 && a == dest) ? NOOPINSTR : -1;
+}
+
+int redundantLoad(programType* program, analysisType* analysis, int pc) {
+    int instr = program->mem[pc];
+    if (opcode(instr) != LW || field0(instr) != 0 || convertNum(field2(instr)) < 0) {
+        return -1;
+    }
+    return analysis->holds[pc][field1(instr)] == convertNum(field2(instr)) ? NOOPINSTR : -1;
+}
+
+int loadToCopy(programType* program, analysisType* analysis, int pc) {
+    int instr = program->mem[pc];
+    if (opcode(instr) != LW || field0(instr) != 0 || convertNum(field2(instr)) < 0) {
+        return -1;
+    }
+    for (int r = 1; r < NUMREGS; ++r) {
+        if (r != field1(instr) && analysis->holds[pc][r] == convertNum(field2(instr))) {
+            return (ADD << 22) | (r << 19) | (0 << 16) | field1(instr);
+        }
+    }
+    return -1;
+}
+
+int redundantStore(programType* program, analysisType* analysis, int pc) {
+    int instr = program->mem[pc];
+    if (opcode(instr) != SW || field0(instr) != 0 || convertNum(field2(instr)) < 0) {
+        return -1;
+    }
+    return analysis->holds[pc][field1(instr)] == convertNum(field2(instr)) ? NOOPINSTR : -1;
+}
+
+int deadWrite(programType* program, analysisType* analysis, int pc) {
+    int instr = program->mem[pc];
+    int op = opcode(instr), dest = writesReg(instr);
+    if ((op != ADD && op != NOR && op != LW) || (analysis->liveOut[pc] & (1 << dest))) {
+        return -1;
+    }
+    return NOOPINSTR;
+}
+
+// run program on the pipeline into state; returns 0 if it does not halt within maxCycles
+int simulate(programType* program, stateType* state, unsigned int maxCycles) {
+    memset(state, 0, sizeof(stateType));
+    loadMemory(state, program->mem, program->numMemory);
+    initState(state);
+    return runProgram(state, maxCycles);
+}
@@ -0,0 +1,540 @@
+/*
+ * EECS 370, University of Michigan, Fall 2023
+ * Project 3: LC-2K Pipeline Simulator
+ * Instructions are found in the project spec: https://eecs370.github.io/project_3_spec/
+ * Make sure NOT to modify printState or any of the associated functions
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipeline.h"
+
+const char* opcode_to_str_map[] = {
+    "add",
+    "nor",
+    "lw",
+    "sw",
+    "beq",
+    "jalr",
+    "halt",
+    "noop"};
+
+unsigned int* breakpointMap = NULL;
+unsigned int* watchpointMap = NULL;
+loadPredictorType* loadPredictor = NULL;
+
+static int predictLoad(loadPredictorType*, int, int*);
+static int verifyLoad(loadPredictorType*, int);
+static int modelWait(pipelineModelType*, stateType*);
+static int resolveBranch(pipelineModelType*, int, int, int, int, int*);
+
+// empty pipeline at pc 0 with cleared registers; memory is left alone
+void initState(stateType* state) {
+    state->cycles = 0;
+    memset(state->reg, 0, sizeof(state->reg));
+    state->pc = 0;
+    state->IFID.instr = NOOPINSTR;
+    state->IDEX.instr = NOOPINSTR;
+    state->EXMEM.instr = NOOPINSTR;
+    state->MEMWB.instr = NOOPINSTR;
+    state->WBEND.instr = NOOPINSTR;
+}
+
+// advance the pipeline by one clock cycle, computing newState from state
+void simulateCycle(stateType* state, stateType* newState, cycleInfoType* info) {
+    simulateModelCycle(state, newState, info, NULL);
+}
+
+// one clock cycle of the pipeline as configured by model (NULL: as specified)
+void simulateModelCycle(stateType* state, stateType* newState, cycleInfoType* info, pipelineModelType* model) {
+    *newState = *state;
+
+    newState->cycles += 1;
+
+    info->memWait = model && modelWait(model, state);
+    if (info->memWait) {
+        // everything stays where it is
+        info->exInstr = info->memInstr = NOOPINSTR;
+        info->aluIn[0] = info->aluIn[1] = info->memAddr = info->memData = 0;
+        info->branchTaken = info->stall = info->hit = 0;
+        info->forward[0] = info->forward[1] = FORWARDNONE;
+        return;
+    }
+
+    /* ---------------------- IF stage --------------------- */
+
+    newState->IFID.instr = state->instrMem[state->pc];
+    newState->IFID.pcPlus1 = state->pc + 1;
+
+    newState->pc = state->pc + 1;
+    int fetchedTaken = 0;
+    if (model && model->config.btbEntries) {
+        int entry = (unsigned int)state->pc % model->config.btbEntries;
+        if (model->btbPc[entry] == state->pc) {
+            newState->pc = model->btbTarget[entry];
+            fetchedTaken = 1;
+        }
+    }
+
+    /* ---------------------- ID stage --------------------- */
+    // You will need to stall for one type of data hazard: a lw followed by an instruction that uses the register being loaded.
+
+    info->stall = opcode(state->IDEX.instr) == LW && isRegUsed(state->IFID.instr, field1(state->IDEX.instr));
+    int predicted = 0, prediction = 0;
+    if (info->stall && loadPredictor) {
+        ++loadPredictor->hazards;
+        predicted = predictLoad(loadPredictor, state->IDEX.pcPlus1 - 1, &prediction);
+        info->stall = !predicted;
+    }
+    if (info->stall) {
+        newState->IDEX.instr = NOOPINSTR;
+        newState->pc = state->pc;
+        newState->IFID = state->IFID;
+    } else {
+        newState->IDEX.instr = state->IFID.instr;
+        newState->IDEX.valA = state->reg[field0(state->IFID.instr)];
+        newState->IDEX.valB = state->reg[field1(state->IFID.instr)];
+        newState->IDEX.pcPlus1 = state->IFID.pcPlus1;
+        newState->IDEX.offset = convertNum(field2(state->IFID.instr));
+    }
+    // a stalled fetch is repeated next cycle, so only the one that sticks counts
+    info->hit = breakpointMap && !info->stall && testAddress(breakpointMap, state->pc) ? HITBREAKPOINT : 0;
+
+    /* ---------------------- EX stage --------------------- */
+    /*
+    Use data forwarding to resolve most data hazards.
+    The ALU should be able to take its inputs from any pipeline register
+    (instead of just the IDEX register).
+    To account for a lack of internal forwarding within the register file,
+    you’ll instead forward data from the new WBEND pipeline register.
+    Remember to take the most recent data
+    (e.g., data in the EXMEM register gets priority over data in the MEMWB register).
+    ONLY FORWARD DATA TO THE EX STAGE (not to memory).
+    */
+
+    newState->EXMEM.branchTarget = state->IDEX.pcPlus1 + state->IDEX.offset;
+    int alu1In = getRegValue(state, field0(state->IDEX.instr), state->IDEX.valA, &info->forward[0]), alu2In = 0;
+    if (opcode(state->IDEX.instr) <= NOR || opcode(state->IDEX.instr) == BEQ)
+        alu2In = getRegValue(state, field1(state->IDEX.instr), state->IDEX.valB, &info->forward[1]);
+    else
+        alu2In = state->IDEX.offset;
+    newState->EXMEM.eq = (alu2In == alu1In);
+    int aluOp = opcode(state->IDEX.instr) == NOR;
+    if (aluOp == 0)
+        newState->EXMEM.aluResult = alu1In + alu2In;
+    else
+        newState->EXMEM.aluResult = ~(alu2In | alu1In);
+    newState->EXMEM.valB = getRegValue(state, field1(state->IDEX.instr), state->IDEX.valB, &info->forward[1]);
+    newState->EXMEM.instr = state->IDEX.instr;
+    info->exInstr = state->IDEX.instr;
+    info->aluIn[0] = alu1In;
+    info->aluIn[1] = alu2In;
+    int exSquash = 0, redirect = 0;
+    if (model && model->config.resolveInEx && opcode(state->IDEX.instr) == BEQ) {
+        exSquash = resolveBranch(model, state->IDEX.pcPlus1 - 1, newState->EXMEM.eq, newState->EXMEM.branchTarget,
+                                 model->fetchedTaken[1], &redirect);
+        if (exSquash) {
+            newState->pc = redirect;
+            newState->IFID.instr = NOOPINSTR;
+            newState->IDEX.instr = NOOPINSTR;
+        }
+    }
+    // printf("========================= ALU: %d %d %d\n", alu1In, alu2In, alu1In == alu2In);
+
+    /* --------------------- MEM stage --------------------- */
+    /*Predict branch-not-taken to speculate on branches,
+    and decide whether or not to take the branch in the MEM stage.
+    This requires you to discard instructions if it turns out
+    that the branch prediction was incorrect.
+    To discard instructions, change the relevant instructions
+    in the pipeline to the noop instruction (0x1c00000).
+     */
+    int opMem = opcode(state->EXMEM.instr);
+    info->memInstr = state->EXMEM.instr;
+    info->memAddr = state->EXMEM.aluResult;
+    info->memData = 0;
+    info->branchTaken = opMem == BEQ && state->EXMEM.eq;
+    if (opMem == SW) {
+        // newState->MEMWB.writeData = state->EXMEM.valB;
+        newState->dataMem[state->EXMEM.aluResult] = state->EXMEM.valB;
+        info->memData = state->EXMEM.valB;
+        if (watchpointMap && testAddress(watchpointMap, state->EXMEM.aluResult)) {
+            info->hit |= HITWATCHPOINT;
+        }
+    } else if (opMem == LW) {
+        newState->MEMWB.writeData = state->dataMem[state->EXMEM.aluResult];
+        info->memData = newState->MEMWB.writeData;
+        if (watchpointMap && testAddress(watchpointMap, state->EXMEM.aluResult)) {
+            info->hit |= HITWATCHPOINT;
+        }
+        if (loadPredictor && !verifyLoad(loadPredictor, newState->MEMWB.writeData)) {
+            // replay from the instruction in EX, which used the wrong value
+            newState->pc = state->IDEX.pcPlus1 - 1;
+            newState->IFID.instr = NOOPINSTR;
+            newState->IDEX.instr = NOOPINSTR;
+            newState->EXMEM.instr = NOOPINSTR;
+            predicted = 0;
+        }
+    } else if (opMem <= NOR) {
+        newState->MEMWB.writeData = state->EXMEM.aluResult;
+    }
+    int memSquash = info->branchTaken;
+    redirect = state->EXMEM.branchTarget;
+    if (model && opMem == BEQ) {
+        memSquash = !model->config.resolveInEx &&
+                    resolveBranch(model, state->EXMEM.branchTarget - convertNum(field2(state->EXMEM.instr)) - 1,
+                                  state->EXMEM.eq, state->EXMEM.branchTarget, model->fetchedTaken[2], &redirect);
+    }
+    if (memSquash) {
+        newState->pc = redirect;
+        newState->IFID.instr = NOOPINSTR;
+        newState->IDEX.instr = NOOPINSTR;
+        newState->EXMEM.instr = NOOPINSTR;
+        predicted = 0;
+    }
+    if (loadPredictor) {
+        loadPredictor->memPc = state->IDEX.pcPlus1 - 1;
+        loadPredictor->memPredicted = predicted;
+        loadPredictor->memValue = prediction;
+    }
+    newState->MEMWB.instr = state->EXMEM.instr;
+    /* ---------------------- WB stage --------------------- */
+    // the starter code stops when the halt instruction reaches the MEMWB register.
+    int opWb = opcode(state->MEMWB.instr);
+    if (opWb == LW) {
+        newState->reg[field1(state->MEMWB.instr)] = state->MEMWB.writeData;
+    }
+    // else if (opWb == SW) {
+    //     newState->dataMem[state->reg[field0(state->MEMWB.instr)] + field2(state->MEMWB.instr)] = state->MEMWB.writeData;
+    // }
+    else if (opWb <= NOR) {
+        newState->reg[field2(state->MEMWB.instr)] = state->MEMWB.writeData;
+    }
+    newState->WBEND.writeData = state->MEMWB.writeData;
+    newState->WBEND.instr = state->MEMWB.instr;
+
+    if (model) {
+        // fetchedTaken follows the instructions down the pipeline; it is only read for beqs
+        model->fetchedTaken[2] = model->fetchedTaken[1];
+        model->fetchedTaken[1] = info->stall ? 0 : model->fetchedTaken[0];
+        model->fetchedTaken[0] = info->stall ? model->fetchedTaken[0] : fetchedTaken;
+        if (exSquash || memSquash) {
+            model->fetchedTaken[0] = model->fetchedTaken[1] = 0;
+        }
+        model->memReady = 0;
+    }
+}
+
+void initModel(pipelineModelType* model, pipelineConfigType* config) {
+    memset(model, 0, sizeof(*model));
+    model->config = *config;
+    if (config->btbEntries) {
+        model->btbPc = malloc(config->btbEntries * sizeof(int));
+        model->btbTarget = malloc(config->btbEntries * sizeof(int));
+        for (int i = 0; i < config->btbEntries; ++i) {
+            model->btbPc[i] = -1;
+        }
+    }
+    if (config->cacheWords) {
+        int lines = config->cacheWords / config->blockWords;
+        model->cacheBlock = malloc(lines * sizeof(unsigned int));
+        model->cacheUsed = calloc(lines, sizeof(unsigned long long));
+    }
+}
+
+void freeModel(pipelineModelType* model) {
+    free(model->btbPc);
+    free(model->btbTarget);
+    free(model->cacheBlock);
+    free(model->cacheUsed);
+}
+
+// whether the pipeline spends this cycle waiting for the lw/sw in MEM; looks it up in the cache first time round
+static int modelWait(pipelineModelType* model, stateType* state) {
+    int op = opcode(state->EXMEM.instr);
+    pipelineConfigType* config = &model->config;
+    if ((op == LW || op == SW) && !model->memReady) {
+        model->memReady = 1;
+        ++model->accesses;
+        int hit = 0;
+        if (config->cacheWords) {
+            unsigned int block = (unsigned int)state->EXMEM.aluResult / config->blockWords;
+            int numSets = config->cacheWords / (config->cacheWays * config->blockWords);
+            int first = (int)(block % numSets) * config->cacheWays, victim = first;
+            ++model->time;
+            for (int line = first; line < first + config->cacheWays && !hit; ++line) {
+                if (model->cacheUsed[line] && model->cacheBlock[line] == block) {
+                    model->cacheUsed[line] = model->time;
+                    hit = 1;
+                } else if (model->cacheUsed[line] < model->cacheUsed[victim]) {
+                    victim = line;
+                }
+            }
+            if (!hit) {
+                model->cacheBlock[victim] = block;
+                model->cacheUsed[victim] = model->time;
+            }
+        }
+        if (!hit) {
+            ++model->misses;
+            model->wait = config->missPenalty;
+        }
+    }
+    if (model->wait == 0) {
+        return 0;
+    }
+    --model->wait;
+    ++model->waitCycles;
+    return 1;
+}
+
+// train the BTB on a beq; returns 1 and where to fetch from if the instructions after it are the wrong ones
+static int resolveBranch(pipelineModelType* model, int pc, int taken, int target, int fetchedTaken, int* redirect) {
+    int entries = model->config.btbEntries;
+    if (entries) {
+        int entry = (unsigned int)pc % entries;
+        if (taken) {
+            model->btbPc[entry] = pc;
+            model->btbTarget[entry] = target;
+        } else if (model->btbPc[entry] == pc) {
+            model->btbPc[entry] = -1;
+        }
+    }
+    if (taken == fetchedTaken) {
+        return 0;
+    }
+    ++model->mispredicts;
+    *redirect = taken ? target : pc + 1;
+    return 1;
+}
+
+// put a program image in both memories
+void loadMemory(stateType* state, int* mem, int numMemory) {
+    memcpy(state->instrMem, mem, numMemory * sizeof(int));
+    memcpy(state->dataMem, mem, numMemory * sizeof(int));
+    state->numMemory = numMemory;
+}
+
+// run silently until halt reaches MEMWB; returns 0 if that takes more than maxCycles (0 = no limit)
+int runProgram(stateType* state, unsigned int maxCycles) {
+    stateType* newState = malloc(sizeof(stateType));
+    cycleInfoType info;
+    while (opcode(state->MEMWB.instr) != HALT) {
+        if (maxCycles && state->cycles >= maxCycles) {
+            free(newState);
+            return 0;
+        }
+        simulateCycle(state, newState, &info);
+        *state = *newState;
+    }
+    free(newState);
+    return 1;
+}
+
+// value of reg as seen by EX; *source is set to the pipeline register it came from
+int getRegValue(stateType* state, int reg, int now, int* source) {
+    if (loadPredictor && loadPredictor->memPredicted && opcode(state->EXMEM.instr) == LW &&
+        field1(state->EXMEM.instr) == reg) {
+        *source = FORWARDEXMEM;
+        return loadPredictor->memValue;
+    }
+    if (opcode(state->EXMEM.instr) <= NOR &&
+        field2(state->EXMEM.instr) == reg) {
+        *source = FORWARDEXMEM;
+        return state->EXMEM.aluResult;
+    }
+    if (opcode(state->MEMWB.instr) <= NOR &&
+        field2(state->MEMWB.instr) == reg) {
+        *source = FORWARDMEMWB;
+        return state->MEMWB.writeData;
+    }
+    if (opcode(state->MEMWB.instr) == LW &&
+        field1(state->MEMWB.instr) == reg) {
+        *source = FORWARDMEMWB;
+        return state->MEMWB.writeData;
+    }
+    if (opcode(state->WBEND.instr) <= NOR &&
+        field2(state->WBEND.instr) == reg) {
+        *source = FORWARDWBEND;
+        return state->WBEND.writeData;
+    }
+    if (opcode(state->WBEND.instr) == LW &&
+        field1(state->WBEND.instr) == reg) {
+        *source = FORWARDWBEND;
+        return state->WBEND.writeData;
+    }
+
+    *source = FORWARDNONE;
+    return now;
+}
+
+// the value the lw at pc should load, if the predictor is confident enough to guess
+static int predictLoad(loadPredictorType* predictor, int pc, int* value) {
+    if ((unsigned int)pc >= NUMMEMORY || predictor->confidence[pc] < PREDICTCONFIDENCE) {
+        return 0;
+    }
+    *value = predictor->last[pc] + (predictor->stride ? predictor->delta[pc] : 0);
+    return 1;
+}
+
+// train on the value the lw in MEM loaded; returns 0 if EX was given a different one
+static int verifyLoad(loadPredictorType* predictor, int value) {
+    int pc = predictor->memPc, right = 1;
+    if (predictor->memPredicted) {
+        ++predictor->predictions;
+        right = value == predictor->memValue;
+        predictor->correct += right;
+    }
+    if ((unsigned int)pc < NUMMEMORY) {
+        int guess = predictor->last[pc] + (predictor->stride ? predictor->delta[pc] : 0);
+        if (value != guess) {
+            predictor->confidence[pc] = 0;
+        } else if (predictor->confidence[pc] < 3) {
+            ++predictor->confidence[pc];
+        }
+        predictor->delta[pc] = value - predictor->last[pc];
+        predictor->last[pc] = value;
+    }
+    return right;
+}
+
+/*
+ * DO NOT MODIFY ANY OF THE CODE BELOW.
+ */
+
+void printInstruction(int instr) {
+    const char* instr_opcode_str;
+    int instr_opcode = opcode(instr);
+    if (ADD <= instr_opcode && instr_opcode <= NOOP) {
+        instr_opcode_str = opcode_to_str_map[instr_opcode];
+    }
+
+    switch (instr_opcode) {
+        case ADD:
+        case NOR:
+        case LW:
+        case SW:
+        case BEQ:
+            printf("%s %d %d %d", instr_opcode_str, field0(instr), field1(instr), convertNum(field2(instr)));
+            break;
+        case JALR:
+            printf("%s %d %d", instr_opcode_str, field0(instr), field1(instr));
+            break;
+        case HALT:
+        case NOOP:
+            printf("%s", instr_opcode_str);
+            break;
+        default:
+            printf(".fill %d", instr);
+            return;
+    }
+}
+
+void printState(stateType* statePtr) {
+    printf("\n@@@\n");
+    printf("state before cycle %d starts:\n", statePtr->cycles);
+    printf("\tpc = %d\n", statePtr->pc);
+
+    printf("\tdata memory:\n");
+    for (int i = 0; i < statePtr->numMemory; ++i) {
+        printf("\t\tdataMem[ %d ] = %d\n", i, statePtr->dataMem[i]);
+    }
+    printf("\tregisters:\n");
+    for (int i = 0; i < NUMREGS; ++i) {
+        printf("\t\treg[ %d ] = %d\n", i, statePtr->reg[i]);
+    }
+
+    // IF/ID
+    printf("\tIF/ID pipeline register:\n");
+    printf("\t\tinstruction = %d ( ", statePtr->IFID.instr);
+    printInstruction(statePtr->IFID.instr);
+    printf(" )\n");
+    printf("\t\tpcPlus1 = %d", statePtr->IFID.pcPlus1);
+    if (opcode(statePtr->IFID.instr) == NOOP) {
+        printf(" (Don't Care)");
+    }
+    printf("\n");
+
+    // ID/EX
+    int idexOp = opcode(statePtr->IDEX.instr);
+    printf("\tID/EX pipeline register:\n");
+    printf("\t\tinstruction = %d ( ", statePtr->IDEX.instr);
+    printInstruction(statePtr->IDEX.instr);
+    printf(" )\n");
+    printf("\t\tpcPlus1 = %d", statePtr->IDEX.pcPlus1);
+    if (idexOp == NOOP) {
+        printf(" (Don't Care)");
+    }
+    printf("\n");
+    printf("\t\treadRegA = %d", statePtr->IDEX.valA);
+    if (idexOp >= HALT || idexOp < 0) {
+        printf(" (Don't Care)");
+    }
+    printf("\n");
+    printf("\t\treadRegB = %d", statePtr->IDEX.valB);
+    if (idexOp == LW || idexOp > BEQ || idexOp < 0) {
+        printf(" (Don't Care)");
+    }
+    printf("\n");
+    printf("\t\toffset = %d", statePtr->IDEX.offset);
+    if (idexOp != LW && idexOp != SW && idexOp != BEQ) {
+        printf(" (Don't Care)");
+    }
+    printf("\n");
+
+    // EX/MEM
+    int exmemOp = opcode(statePtr->EXMEM.instr);
+    printf("\tEX/MEM pipeline register:\n");
+    printf("\t\tinstruction = %d ( ", statePtr->EXMEM.instr);
+    printInstruction(statePtr->EXMEM.instr);
+    printf(" )\n");
+    printf("\t\tbranchTarget %d", statePtr->EXMEM.branchTarget);
+    if (exmemOp != BEQ) {
+        printf(" (Don't Care)");
+    }
+    printf("\n");
+    printf("\t\teq ? %s", (statePtr->EXMEM.eq ? "True" : "False"));
+    if (exmemOp != BEQ) {
+        printf(" (Don't Care)");
+    }
+    printf("\n");
+    printf("\t\taluResult = %d", statePtr->EXMEM.aluResult);
+    if (exmemOp > SW || exmemOp < 0) {
+        printf(" (Don't Care)");
+    }
+    printf("\n");
+    printf("\t\treadRegB = %d", statePtr->EXMEM.valB);
+    if (exmemOp != SW) {
+        printf(" (Don't Care)");
+    }
+    printf("\n");
+
+    // MEM/WB
+    int memwbOp = opcode(statePtr->MEMWB.instr);
+    printf("\tMEM/WB pipeline register:\n");
+    printf("\t\tinstruction = %d ( ", statePtr->MEMWB.instr);
+    printInstruction(statePtr->MEMWB.instr);
+    printf(" )\n");
+    printf("\t\twriteData = %d", statePtr->MEMWB.writeData);
+    if (memwbOp >= SW || memwbOp < 0) {
+        printf(" (Don't Care)");
+    }
+    printf("\n");
+
+    // WB/END
+    int wbendOp = opcode(statePtr->WBEND.instr);
+    printf("\tWB/END pipeline register:\n");
+    printf("\t\tinstruction = %d ( ", statePtr->WBEND.instr);
+    printInstruction(statePtr->WBEND.instr);
+    printf(" )\n");
+    printf("\t\twriteData = %d", statePtr->WBEND.writeData);
+    if (wbendOp >= SW || wbendOp < 0) {
+        printf(" (Don't Care)");
+    }
+    printf("\n");
+
+    printf("end state\n");
+    fflush(stdout);
+}
@@ -0,0 +1,148 @@
+/*
+ * The LC-2K project 3 pipeline: pipeline registers, machine state and the
+ * per-cycle step, shared by the simulator and the tools that simulate
+ * programs in-process.
+ **/
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "lc2k.h"
+
+extern const char* opcode_to_str_map[];
+
+typedef struct IFIDStruct {
+    int pcPlus1;
+    int instr;
+} IFIDType;
+
+typedef struct IDEXStruct {
+    int pcPlus1;
+    int valA;
+    int valB;
+    int offset;
+    int instr;
+} IDEXType;
+
+typedef struct EXMEMStruct {
+    int branchTarget;
+    int eq;
+    int aluResult;
+    int valB;
+    int instr;
+} EXMEMType;
+
+typedef struct MEMWBStruct {
+    int writeData;
+    int instr;
+} MEMWBType;
+
+typedef struct WBENDStruct {
+    int writeData;
+    int instr;
+} WBENDType;
+
+typedef struct stateStruct {
+    int pc;
+    int instrMem[NUMMEMORY];
+    int dataMem[NUMMEMORY];
+    int reg[NUMREGS];
+    unsigned int numMemory;
+    IFIDType IFID;
+    IDEXType IDEX;
+    EXMEMType EXMEM;
+    MEMWBType MEMWB;
+    WBENDType WBEND;
+    unsigned int cycles;  // number of cycles run so far
+} stateType;
+
+// What happened inside the pipeline during one cycle
+typedef struct cycleInfoStruct {
+    int exInstr;       // instruction in the EX stage
+    int aluIn[2];      // ALU inputs after forwarding
+    int memInstr;      // instruction in the MEM stage
+    int memAddr;       // address of lw/sw
+    int memData;       // value loaded by lw or stored by sw
+    int branchTaken;   // beq in MEM resolved as taken
+    int stall;         // ID held its instruction for a load-use hazard
+    int forward[2];    // where EX got regA and regB from (FORWARD*)
+    int hit;           // HIT* flags: a breakpoint or watchpoint fired
+    int memWait;       // the pipeline waited for the data access in MEM (pipelineModelType only)
+} cycleInfoType;
+
+// sources getRegValue can forward a register from
+#define FORWARDNONE 0
+#define FORWARDEXMEM 1
+#define FORWARDMEMWB 2
+#define FORWARDWBEND 3
+
+// Breakpoints and watchpoints: one bit per address, NULL when none are set
+extern unsigned int* breakpointMap;  // pcs, checked when IF fetches
+extern unsigned int* watchpointMap;  // data addresses, checked by lw and sw in MEM
+
+#define HITBREAKPOINT 1
+#define HITWATCHPOINT 2
+
+static inline int testAddress(unsigned int* map, int addr) {
+    return (unsigned int)addr < NUMMEMORY && (map[addr >> 5] >> (addr & 31) & 1);
+}
+
+// Load-value prediction, off while loadPredictor is NULL. When ID finds an
+// instruction that needs the value of the lw in EX, a confident predictor
+// lets it go on with a predicted value instead of stalling; MEM checks the
+// loaded value and on a misprediction squashes everything behind the lw and
+// fetches it again. The tables live outside stateType, so a run with
+// prediction must call simulateCycle on each cycle's result in turn.
+typedef struct loadPredictorStruct {
+    int stride;                           // predict last value + last stride instead of the last value
+    int last[NUMMEMORY];                  // per lw pc: the value it loaded last time
+    int delta[NUMMEMORY];                 // and how much that differed from the time before
+    unsigned char confidence[NUMMEMORY];  // 2-bit counter, cleared by a wrong guess
+    int memPc;                            // the lw in MEM: its pc,
+    int memPredicted, memValue;           // and the value EX was given for it, if any
+    unsigned long long hazards;           // load-use hazards ID found
+    unsigned long long predictions, correct;
+} loadPredictorType;
+
+extern loadPredictorType* loadPredictor;
+
+#define PREDICTCONFIDENCE 2  // confidence needed to predict
+
+// Variations on the pipeline for design-space sweeps
+typedef struct pipelineConfigStruct {
+    int resolveInEx;   // beq resolves in EX, squashing 2 instructions instead of 3 in MEM
+    int btbEntries;    // direct-mapped branch target buffer of taken beqs, 0 for none (predict not taken)
+    int cacheWords;    // data cache size, 0 for none: every lw and sw misses
+    int cacheWays;
+    int blockWords;
+    int missPenalty;   // cycles the pipeline waits for a data access that misses
+} pipelineConfigType;
+
+// A configuration and what it remembers between cycles outside stateType.
+// simulateModelCycle with a NULL model is the pipeline as specified, which is
+// also a configuration with no BTB, no cache and a miss penalty of 0.
+typedef struct pipelineModelStruct {
+    pipelineConfigType config;
+    int* btbPc;                     // beq each entry holds, -1 if none
+    int* btbTarget;
+    unsigned int* cacheBlock;       // block each line holds
+    unsigned long long* cacheUsed;  // time of the line's latest access, 0 if it is empty
+    unsigned long long time;
+    int fetchedTaken[3];            // the beq in IFID, IDEX, EXMEM was followed by its BTB target
+    int memReady;                   // the lw/sw in MEM is done waiting
+    int wait;                       // cycles it still has to wait
+    unsigned long long mispredicts, accesses, misses, waitCycles;
+} pipelineModelType;
+
+void initModel(pipelineModelType*, pipelineConfigType*);
+void freeModel(pipelineModelType*);
+void simulateModelCycle(stateType*, stateType*, cycleInfoType*, pipelineModelType*);
+void initState(stateType*);
+void loadMemory(stateType*, int*, int);
+void simulateCycle(stateType*, stateType*, cycleInfoType*);
+int runProgram(stateType*, unsigned int);
+int getRegValue(stateType*, int, int, int*);
+void printState(stateType*);
+void printInstruction(int);
+
+#endif
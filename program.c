@@ -0,0 +1,74 @@
+/*
+ * Reading, writing and control-flow analysis of LC-2K machine code.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "program.h"
+
+void readProgram(programType* program, char* filename) {
+    char line[MAXLINELENGTH];
+    FILE* filePtr = fopen(filename, "r");
+    if (filePtr == NULL) {
+        printf("error: can't open file %s\n", filename);
+        exit(1);
+    }
+    for (program->numMemory = 0; fgets(line, MAXLINELENGTH, filePtr) != NULL; ++program->numMemory) {
+        if (program->numMemory == NUMMEMORY || sscanf(line, "%d", program->mem + program->numMemory) != 1) {
+            printf("error in reading address %d\n", program->numMemory);
+            exit(1);
+        }
+    }
+    fclose(filePtr);
+    memset(program->reachable, 0, sizeof(program->reachable));
+    memset(program->leader, 0, sizeof(program->leader));
+}
+
+void writeProgram(programType* program, FILE* filePtr) {
+    for (int i = 0; i < program->numMemory; ++i) {
+        fprintf(filePtr, "%d\n", program->mem[i]);
+    }
+}
+
+// walk the control-flow graph from pc 0, marking reachable instructions and block leaders
+void findBlocks(programType* program) {
+    static int work[NUMMEMORY];
+    int numWork = 0;
+    work[numWork++] = 0;
+    program->leader[0] = 1;
+    while (numWork > 0) {
+        int pc = work[--numWork];
+        for (; pc >= 0 && pc < program->numMemory && !program->reachable[pc]; ++pc) {
+            int instr = program->mem[pc];
+            program->reachable[pc] = 1;
+            if (opcode(instr) == HALT) {
+                break;
+            }
+            if (opcode(instr) == BEQ) {
+                int target = pc + 1 + convertNum(field2(instr));
+                if (target >= 0 && target < program->numMemory) {
+                    program->leader[target] = 1;
+                    work[numWork++] = target;
+                }
+                if (field0(instr) == field1(instr)) {
+                    break;  // always taken, never falls through
+                }
+                if (pc + 1 < program->numMemory) {
+                    program->leader[pc + 1] = 1;
+                }
+            }
+        }
+    }
+}
+
+// does the instruction at pc stall in ID when it follows the one before it?
+// (a taken beq never leads into a stall: the squash leaves noops behind it)
+int loadUseStall(programType* program, int pc) {
+    if (pc <= 0 || pc >= program->numMemory || !program->reachable[pc]) {
+        return 0;
+    }
+    int prev = program->mem[pc - 1];
+    return program->reachable[pc - 1] && opcode(prev) == LW && isRegUsed(program->mem[pc], field1(prev));
+}
@@ -0,0 +1,25 @@
+/*
+ * LC-2K machine code as a static program: reading and writing .mc files and
+ * the control-flow facts the analysis tools share.
+ **/
+
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include "lc2k.h"
+
+#define MAXLINELENGTH 1000
+
+typedef struct programStruct {
+    int mem[NUMMEMORY];
+    int numMemory;
+    char reachable[NUMMEMORY];  // can be fetched on some path from pc 0
+    char leader[NUMMEMORY];     // first instruction of a basic block
+} programType;
+
+void readProgram(programType*, char*);
+void writeProgram(programType*, FILE*);
+void findBlocks(programType*);
+int loadUseStall(programType*, int);
+
+#endif
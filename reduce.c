@@ -0,0 +1,331 @@
+/*
+ * Delta-debugging reducer for programs on which two simulator builds
+ * disagree. Both builds are loaded into this process as shared objects
+ * (make pipeline.so, or any other pipeline.c built the same way) and run
+ * in lockstep; a program is interesting if their printState traces differ
+ * at some cycle. Starting from the given program, the reducer tries
+ * cutting chunks of words out (rewriting beq offsets so every kept beq
+ * still reaches the same kept instruction) and turning chunks of
+ * instructions into noops, halving the chunk size when nothing works, and
+ * keeps any candidate that is still interesting. A candidate only gets
+ * twice as many cycles as the current program needs to diverge (plus some
+ * slack): reductions that push the divergence much later are not worth
+ * simulating, and most candidates that agree would otherwise run to the
+ * cycle limit. Candidates are tried in
+ * parallel batches; the first interesting one in program order wins, so
+ * the result does not depend on the number of threads.
+ **/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pipeline.h"
+#include "program.h"
+
+#define MAXTHREADS 64
+#define BATCHPERTHREAD 2  // candidates per thread in each batch
+#define SLACKCYCLES 64    // a candidate may diverge this much later than twice the current cycle
+
+#define CUT 0
+#define BLANK 1
+
+typedef struct simulatorStruct {
+    void (*loadMemory)(stateType*, int*, int);
+    void (*initState)(stateType*);
+    void (*simulateCycle)(stateType*, stateType*, cycleInfoType*);
+} simulatorType;
+
+typedef struct candidateStruct {
+    int* mem;
+    int numMemory;
+    long diverge;                 // first differing cycle, -1 if the traces agree
+} candidateType;
+
+typedef struct reducerStruct {
+    simulatorType sim[2];
+    unsigned int maxCycles;
+    unsigned int limit;           // cycles a candidate is run for
+    int numThreads;
+    candidateType* batch;
+    int batchSize;
+    int next;                     // next candidate of the batch to run, taken with an atomic add
+    unsigned long long tested;
+} reducerType;
+
+void loadSimulator(simulatorType*, char*);
+long diverge(reducerType*, int*, int, stateType**);
+int makeCandidate(programType*, int, int, int, candidateType*);
+void runBatch(reducerType*);
+
+int main(int argc, char* argv[]) {
+    static programType program;
+    static reducerType reducer;
+    reducer.maxCycles = 100000;  // -m <cycles>: a run that goes longer is treated as agreeing
+    reducer.numThreads = 4;      // -j <threads>
+
+    int argi = 1;
+    for (; argi < argc - 4 && argv[argi][0] == '-'; ++argi) {
+        if (!strcmp(argv[argi], "-m") && argi + 1 < argc - 4) {
+            reducer.maxCycles = (unsigned int)strtoul(argv[++argi], NULL, 10);
+        } else if (!strcmp(argv[argi], "-j") && argi + 1 < argc - 4) {
+            reducer.numThreads = atoi(argv[++argi]);
+        } else {
+            break;
+        }
+    }
+    if (argc - argi != 4 || reducer.numThreads < 1 || reducer.numThreads > MAXTHREADS) {
+        printf("error: usage: %s [-j threads] [-m maxCycles] <simulator.so> <simulator.so> <machine-code file> <output file>\n",
+               argv[0]);
+        exit(1);
+    }
+    loadSimulator(&reducer.sim[0], argv[argi]);
+    loadSimulator(&reducer.sim[1], argv[argi + 1]);
+    readProgram(&program, argv[argi + 2]);
+
+    stateType* states[4];
+    for (int i = 0; i < 4; ++i) {
+        states[i] = malloc(sizeof(stateType));
+    }
+    reducer.limit = reducer.maxCycles;
+    long first = diverge(&reducer, program.mem, program.numMemory, states);
+    if (first < 0) {
+        printf("error: the simulators agree on %s for %u cycles\n", argv[argi + 2], reducer.maxCycles);
+        exit(1);
+    }
+
+    reducer.limit = 2 * (unsigned long)first + SLACKCYCLES < reducer.maxCycles ? 2 * (unsigned int)first + SLACKCYCLES
+                                                                                : reducer.maxCycles;
+    struct timespec began, ended;
+    clock_gettime(CLOCK_MONOTONIC, &began);
+    int originalSize = program.numMemory;
+    reducer.batchSize = reducer.numThreads * BATCHPERTHREAD;
+    reducer.batch = malloc((size_t)reducer.batchSize * sizeof(candidateType));
+    for (int i = 0; i < reducer.batchSize; ++i) {
+        reducer.batch[i].mem = malloc(NUMMEMORY * sizeof(int));
+    }
+
+    // ddmin-style passes until neither cutting nor blanking finds anything
+    for (int changed = 1; changed;) {
+        changed = 0;
+        for (int op = CUT; op <= BLANK; ++op) {
+            for (int chunk = program.numMemory / 2 > 0 ? program.numMemory / 2 : 1; chunk >= 1; chunk /= 2) {
+                for (int pos = 0; pos < program.numMemory;) {
+                    memset(program.reachable, 0, sizeof(program.reachable));
+                    memset(program.leader, 0, sizeof(program.leader));
+                    findBlocks(&program);
+                    int numCandidates = 0, starts[MAXTHREADS * BATCHPERTHREAD];
+                    int at = pos;
+                    for (; at < program.numMemory && numCandidates < reducer.batchSize; at += chunk) {
+                        if (makeCandidate(&program, op, at, chunk, reducer.batch + numCandidates)) {
+                            starts[numCandidates++] = at;
+                        }
+                    }
+                    int saved = reducer.batchSize;
+                    reducer.batchSize = numCandidates;
+                    runBatch(&reducer);
+                    reducer.batchSize = saved;
+
+                    int k = 0;
+                    while (k < numCandidates && reducer.batch[k].diverge < 0) {
+                        ++k;
+                    }
+                    if (k == numCandidates) {
+                        pos = at;
+                        continue;
+                    }
+                    memcpy(program.mem, reducer.batch[k].mem, (size_t)reducer.batch[k].numMemory * sizeof(int));
+                    program.numMemory = reducer.batch[k].numMemory;
+                    first = reducer.batch[k].diverge;
+                    if (2 * (unsigned long)first + SLACKCYCLES < reducer.limit) {
+                        reducer.limit = 2 * (unsigned int)first + SLACKCYCLES;
+                    }
+                    changed = 1;
+                    pos = op == CUT ? starts[k] : starts[k] + chunk;
+                }
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ended);
+
+    char text[MAXLINELENGTH];
+    for (int pc = 0; pc < program.numMemory; ++pc) {
+        instructionText(program.mem[pc], text);
+        printf("\t%d: %s\n", pc, text);
+    }
+    printf("%d words reduced to %d in %.2f s (%llu candidates); traces first differ in cycle %ld\n", originalSize,
+           program.numMemory,
+           (double)(ended.tv_sec - began.tv_sec) + (double)(ended.tv_nsec - began.tv_nsec) / 1e9, reducer.tested,
+           first);
+
+    FILE* outFilePtr = fopen(argv[argi + 3], "w");
+    if (outFilePtr == NULL) {
+        printf("error: can't open file %s\n", argv[argi + 3]);
+        exit(1);
+    }
+    writeProgram(&program, outFilePtr);
+    fclose(outFilePtr);
+    return 0;
+}
+
+void loadSimulator(simulatorType* sim, char* filename) {
+    // dlopen only searches the library path for names without a slash
+    char path[MAXLINELENGTH];
+    snprintf(path, sizeof(path), "%s%s", strchr(filename, '/') ? "" : "./", filename);
+    void* handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        printf("error: can't load %s: %s\n", filename, dlerror());
+        exit(1);
+    }
+    *(void**)&sim->loadMemory = dlsym(handle, "loadMemory");
+    *(void**)&sim->initState = dlsym(handle, "initState");
+    *(void**)&sim->simulateCycle = dlsym(handle, "simulateCycle");
+    if (!sim->loadMemory || !sim->initState || !sim->simulateCycle) {
+        printf("error: %s lacks loadMemory, initState or simulateCycle\n", filename);
+        exit(1);
+    }
+}
+
+// would the next cycle index outside memory or the registers? (a candidate can compute any address,
+// and a cut that removes the halt runs into data words, whose field2 WB takes as a destination)
+static int outOfRange(stateType* state) {
+    int op = opcode(state->EXMEM.instr);
+    int opWb = opcode(state->MEMWB.instr);
+    return state->pc < 0 || state->pc >= NUMMEMORY ||
+           ((op == LW || op == SW) && (state->EXMEM.aluResult < 0 || state->EXMEM.aluResult >= NUMMEMORY)) ||
+           (opWb <= NOR && field2(state->MEMWB.instr) >= NUMREGS);
+}
+
+// would printState print the same block for both?
+static int samePrinted(stateType* a, stateType* b) {
+    return a->pc == b->pc && !memcmp(a->reg, b->reg, sizeof(a->reg)) && !memcmp(&a->IFID, &b->IFID, sizeof(a->IFID)) &&
+           !memcmp(&a->IDEX, &b->IDEX, sizeof(a->IDEX)) && !memcmp(&a->EXMEM, &b->EXMEM, sizeof(a->EXMEM)) &&
+           !memcmp(&a->MEMWB, &b->MEMWB, sizeof(a->MEMWB)) && !memcmp(&a->WBEND, &b->WBEND, sizeof(a->WBEND)) &&
+           !memcmp(a->dataMem, b->dataMem, a->numMemory * sizeof(int));
+}
+
+/*
+ * Run both simulators on a program in lockstep; returns the first cycle
+ * whose state differs, or -1 if they agree up to halt, for limit cycles, or
+ * until the program would leave memory. states holds four scratch states.
+ **/
+long diverge(reducerType* reducer, int* mem, int numMemory, stateType** states) {
+    stateType* a = states[0];
+    stateType* b = states[2];
+    for (int i = 0; i < 2; ++i) {
+        memset(states[2 * i], 0, sizeof(stateType));
+        reducer->sim[i].loadMemory(states[2 * i], mem, numMemory);
+        reducer->sim[i].initState(states[2 * i]);
+    }
+    stateType* nextA = states[1];
+    stateType* nextB = states[3];
+    while (1) {
+        if (!samePrinted(a, b)) {
+            return a->cycles;
+        }
+        if (opcode(a->MEMWB.instr) == HALT || a->cycles >= reducer->limit || outOfRange(a) || outOfRange(b)) {
+            return -1;
+        }
+        cycleInfoType info;
+        reducer->sim[0].simulateCycle(a, nextA, &info);
+        reducer->sim[1].simulateCycle(b, nextB, &info);
+        stateType* swap = a;
+        a = nextA;
+        nextA = swap;
+        swap = b;
+        b = nextB;
+        nextB = swap;
+    }
+}
+
+/*
+ * The program with words [at, at + chunk) cut out or blanked (reachable
+ * instructions become noops, other words 0). Cutting rewrites every
+ * reachable beq so it still reaches the same kept word, and every reachable
+ * lw or sw with regA 0 so it still reads or writes the same kept word; one
+ * aimed into the cut goes to the word after it. Addresses computed from
+ * other registers are left alone. Returns 0 if the candidate would be empty
+ * or unchanged, or an offset would not fit.
+ **/
+int makeCandidate(programType* program, int op, int at, int chunk, candidateType* candidate) {
+    int end = at + chunk < program->numMemory ? at + chunk : program->numMemory;
+    if (op == BLANK) {
+        int changed = 0;
+        memcpy(candidate->mem, program->mem, (size_t)program->numMemory * sizeof(int));
+        for (int pc = at; pc < end; ++pc) {
+            int blank = program->reachable[pc] ? NOOPINSTR : 0;
+            changed |= candidate->mem[pc] != blank;
+            candidate->mem[pc] = blank;
+        }
+        candidate->numMemory = program->numMemory;
+        return changed;
+    }
+
+    int cut = end - at;
+    if (cut == program->numMemory) {
+        return 0;
+    }
+    int n = 0;
+    for (int pc = 0; pc < program->numMemory; ++pc) {
+        if (pc >= at && pc < end) {
+            continue;
+        }
+        int instr = program->mem[pc];
+        if (opcode(instr) == BEQ && program->reachable[pc]) {
+            int target = pc + 1 + convertNum(field2(instr));
+            int newTarget = target < at ? target : target >= end ? target - cut : at;
+            int offset = newTarget - n - 1;
+            if (offset < -32768 || offset > 32767) {
+                return 0;
+            }
+            instr = (instr & ~0xffff) | (offset & 0xffff);
+        }
+        if ((opcode(instr) == LW || opcode(instr) == SW) && field0(instr) == 0 && program->reachable[pc]) {
+            int addr = convertNum(field2(instr));
+            int newAddr = addr < at ? addr : addr >= end ? addr - cut : at;
+            instr = (instr & ~0xffff) | (newAddr & 0xffff);
+        }
+        candidate->mem[n++] = instr;
+    }
+    candidate->numMemory = n;
+    return 1;
+}
+
+static void* batchWorker(void* arg) {
+    reducerType* reducer = arg;
+    stateType* states[4];
+    for (int i = 0; i < 4; ++i) {
+        states[i] = malloc(sizeof(stateType));
+    }
+    int k;
+    while ((k = __atomic_fetch_add(&reducer->next, 1, __ATOMIC_RELAXED)) < reducer->batchSize) {
+        candidateType* candidate = reducer->batch + k;
+        candidate->diverge = diverge(reducer, candidate->mem, candidate->numMemory, states);
+    }
+    for (int i = 0; i < 4; ++i) {
+        free(states[i]);
+    }
+    return NULL;
+}
+
+// run every candidate of the batch, each on whichever thread gets to it
+void runBatch(reducerType* reducer) {
+    pthread_t threads[MAXTHREADS];
+    int numThreads = reducer->numThreads < reducer->batchSize ? reducer->numThreads : reducer->batchSize;
+    reducer->next = 0;
+    for (int i = 0; i < numThreads; ++i) {
+        if (pthread_create(threads + i, NULL, batchWorker, reducer)) {
+            printf("error: can't start worker thread\n");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < numThreads; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    reducer->tested += (unsigned long long)reducer->batchSize;
+}
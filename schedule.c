@@ -0,0 +1,274 @@
+/*
+ * Instruction scheduler for LC-2K machine code on the project 3 pipeline.
+ * Reorders the instructions of each basic block so that a lw is not
+ * immediately followed by an instruction that reads its result, which
+ * would stall one cycle in ID. Blocks are list-scheduled over a dependence
+ * DAG (register RAW/WAR/WAW and lw/sw memory ordering); the beq, halt or
+ * jalr that ends a block stays last. Every block keeps its address range
+ * and branch targets are always block leaders, so no beq offset changes.
+ * Both programs are then simulated on
+ * the pipeline to check they compute the same result and to report the
+ * cycles saved.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipeline.h"
+#include "program.h"
+
+#define MAXBLOCK 256  // longest run of instructions scheduled as one block
+
+typedef struct dagStruct {
+    int size;                       // movable instructions in the block
+    int instr[MAXBLOCK];
+    int numPreds[MAXBLOCK];         // unscheduled predecessors left
+    int height[MAXBLOCK];           // longest latency-weighted path to the end of the block
+    char edge[MAXBLOCK][MAXBLOCK];  // edge[i][j]: i must stay before j
+} dagType;
+
+void markJumpTargets(programType*);
+int dependsOn(int*, int, int);
+int scheduleBlock(programType*, int, int, int, dagType*);
+int countStalls(int, int*, int, int);
+int simulate(programType*, stateType*, unsigned int);
+
+int main(int argc, char* argv[]) {
+    static programType program, original;
+    static dagType dag;
+    static stateType before, after;
+    unsigned int maxCycles = 100000000;  // -m <cycles>: give up simulating after this many cycles
+
+    int argi = 1;
+    if (argc == 5 && !strcmp(argv[1], "-m")) {
+        maxCycles = strtoul(argv[2], NULL, 10);
+        argi = 3;
+    }
+    if (argc - argi != 2) {
+        printf("error: usage: %s [-m maxCycles] <machine-code file> <output file>\n", argv[0]);
+        exit(1);
+    }
+    readProgram(&program, argv[argi]);
+    findBlocks(&program);
+    markJumpTargets(&program);
+    original = program;
+
+    // blocks run from a leader to a beq, halt or jalr, or up to the next leader
+    int staticSaved = 0;
+    for (int start = 0; start < program.numMemory;) {
+        if (!program.reachable[start]) {
+            ++start;
+            continue;
+        }
+        int end = start;
+        while (1) {
+            int op = opcode(program.mem[end]);
+            if (op == BEQ || op == HALT || op == JALR || end + 1 >= program.numMemory ||
+                !program.reachable[end + 1] || program.leader[end + 1] || end + 1 - start == MAXBLOCK) {
+                break;
+            }
+            ++end;
+        }
+        staticSaved += scheduleBlock(&program, start, end, start > 0 && program.reachable[start - 1], &dag);
+        start = end + 1;
+    }
+
+    char text[MAXLINELENGTH];
+    int moved = 0;
+    for (int pc = 0; pc < program.numMemory; ++pc) {
+        if (program.mem[pc] != original.mem[pc]) {
+            instructionText(original.mem[pc], text);
+            printf("\tpc %d: %s", pc, text);
+            instructionText(program.mem[pc], text);
+            printf(" -> %s\n", text);
+            ++moved;
+        }
+    }
+    printf("%d instructions moved, %d static load-use stalls removed\n", moved, staticSaved);
+
+    int haltedBefore = simulate(&original, &before, maxCycles);
+    int haltedAfter = simulate(&program, &after, maxCycles);
+    if (!haltedBefore) {
+        printf("original program does not halt within %u cycles; output not checked\n", maxCycles);
+    } else {
+        int same = haltedAfter && !memcmp(before.reg, after.reg, sizeof(before.reg));
+        for (int addr = 0; same && addr < NUMMEMORY; ++addr) {
+            // code words are expected to differ, data must not
+            if (addr >= program.numMemory || program.mem[addr] == original.mem[addr]) {
+                same = before.dataMem[addr] == after.dataMem[addr];
+            }
+        }
+        if (!same) {
+            printf("scheduled program computes a different result; keeping the original\n");
+            program = original;
+        } else {
+            printf("%u cycles -> %u cycles (%d saved)\n", before.cycles, after.cycles,
+                   (int)before.cycles - (int)after.cycles);
+        }
+    }
+
+    FILE* outFilePtr = fopen(argv[argi + 1], "w");
+    if (outFilePtr == NULL) {
+        printf("error: can't open file %s\n", argv[argi + 1]);
+        exit(1);
+    }
+    writeProgram(&program, outFilePtr);
+    fclose(outFilePtr);
+    return 0;
+}
+
+/*
+ * findBlocks does not follow jalr, so be conservative around it: the
+ * instruction after a jalr is a return point, and any word whose value is
+ * the address of an instruction may be loaded and jumped to.
+ **/
+void markJumpTargets(programType* program) {
+    int hasJalr = 0;
+    for (int pc = 0; pc < program->numMemory; ++pc) {
+        if (program->reachable[pc] && opcode(program->mem[pc]) == JALR) {
+            hasJalr = 1;
+            if (pc + 1 < program->numMemory) {
+                program->leader[pc + 1] = 1;
+            }
+        }
+    }
+    for (int pc = 0; hasJalr && pc < program->numMemory; ++pc) {
+        int value = program->mem[pc];
+        if (value >= 0 && value < program->numMemory) {
+            program->leader[value] = 1;
+        }
+    }
+}
+
+// must block[j] stay after block[i] (i < j)?
+int dependsOn(int* block, int i, int j) {
+    int a = block[i], b = block[j];
+    int writeA = writesReg(a), writeB = writesReg(b);
+    if ((writeA >= 0 && isRegUsed(b, writeA)) ||   // RAW
+        (writeB >= 0 && isRegUsed(a, writeB)) ||   // WAR
+        (writeA >= 0 && writeA == writeB)) {       // WAW
+        return 1;
+    }
+    int memA = opcode(a) == LW || opcode(a) == SW, memB = opcode(b) == LW || opcode(b) == SW;
+    if (!memA || !memB || (opcode(a) == LW && opcode(b) == LW)) {
+        return 0;
+    }
+    // a store and another access: only distinct offsets from an unchanged base are known not to alias
+    if (field0(a) != field0(b) || field2(a) == field2(b)) {
+        return 1;
+    }
+    for (int k = i; k < j; ++k) {
+        if (writesReg(block[k]) == field0(a)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// stalls in ID over the sequence prev, block[0..size), next (prev/next NOOPINSTR if none)
+int countStalls(int prev, int* block, int size, int next) {
+    int stalls = 0;
+    for (int i = 0; i <= size; ++i) {
+        int instr = i < size ? block[i] : next;
+        if (opcode(prev) == LW && isRegUsed(instr, field1(prev))) {
+            ++stalls;
+        }
+        prev = instr;
+    }
+    return stalls;
+}
+
+/*
+ * List-schedule the instructions in [start, end] of program, leaving a
+ * terminating beq, halt or jalr in place. The instruction before start
+ * counts when the block can be entered by falling through, and the first
+ * instruction of the next block when this one falls through into it. Among the ready
+ * instructions we take one that does not read the lw just placed, then the
+ * one with the longest path to the end of the block, then the earliest.
+ * The block is rewritten only if that removes stalls; returns how many.
+ **/
+int scheduleBlock(programType* program, int start, int end, int fallsIn, dagType* dag) {
+    int* mem = program->mem;
+    int last = opcode(mem[end]);
+    int terminator = last == BEQ || last == HALT || last == JALR ? mem[end] : NOOPINSTR;
+    // what runs right after the movable instructions
+    int next = terminator;
+    if (terminator == NOOPINSTR && end + 1 < program->numMemory && program->reachable[end + 1]) {
+        next = mem[end + 1];
+    }
+    int prev = NOOPINSTR;
+    if (fallsIn) {
+        int op = opcode(mem[start - 1]);
+        int alwaysTaken = op == BEQ && field0(mem[start - 1]) == field1(mem[start - 1]);
+        prev = op == HALT || op == JALR || alwaysTaken ? NOOPINSTR : mem[start - 1];
+    }
+
+    dag->size = end - start + (terminator == NOOPINSTR);
+    if (dag->size < 2) {
+        return 0;
+    }
+    memcpy(dag->instr, mem + start, dag->size * sizeof(int));
+    for (int j = 0; j < dag->size; ++j) {
+        dag->numPreds[j] = 0;
+        for (int i = 0; i < j; ++i) {
+            dag->edge[i][j] = dependsOn(dag->instr, i, j);
+            dag->numPreds[j] += dag->edge[i][j];
+        }
+    }
+    // a lw counts two cycles of latency, so loads are started early
+    for (int i = dag->size - 1; i >= 0; --i) {
+        int latency = opcode(dag->instr[i]) == LW ? 2 : 1;
+        dag->height[i] = latency;
+        for (int j = i + 1; j < dag->size; ++j) {
+            if (dag->edge[i][j] && dag->height[j] + latency > dag->height[i]) {
+                dag->height[i] = dag->height[j] + latency;
+            }
+        }
+    }
+
+    int order[MAXBLOCK];
+    char done[MAXBLOCK] = {0};
+    int placed = prev;
+    for (int n = 0; n < dag->size; ++n) {
+        int best = -1, bestStalls = 0;
+        for (int i = 0; i < dag->size; ++i) {
+            if (done[i] || dag->numPreds[i] > 0) {
+                continue;
+            }
+            int stalls = opcode(placed) == LW && isRegUsed(dag->instr[i], field1(placed));
+            if (n == dag->size - 1 && opcode(dag->instr[i]) == LW) {
+                stalls += isRegUsed(next, field1(dag->instr[i]));
+            }
+            if (best < 0 || stalls < bestStalls || (stalls == bestStalls && dag->height[i] > dag->height[best])) {
+                best = i;
+                bestStalls = stalls;
+            }
+        }
+        order[n] = best;
+        done[best] = 1;
+        placed = dag->instr[best];
+        for (int j = best + 1; j < dag->size; ++j) {
+            dag->numPreds[j] -= dag->edge[best][j];
+        }
+    }
+
+    int scheduled[MAXBLOCK];
+    for (int n = 0; n < dag->size; ++n) {
+        scheduled[n] = dag->instr[order[n]];
+    }
+    int saved = countStalls(prev, dag->instr, dag->size, next) - countStalls(prev, scheduled, dag->size, next);
+    if (saved > 0) {
+        memcpy(mem + start, scheduled, dag->size * sizeof(int));
+        return saved;
+    }
+    return 0;
+}
+
+// run program on the pipeline into state; returns 0 if it does not halt within maxCycles
+int simulate(programType* program, stateType* state, unsigned int maxCycles) {
+    memset(state, 0, sizeof(stateType));
+    loadMemory(state, program->mem, program->numMemory);
+    initState(state);
+    return runProgram(state, maxCycles);
+}
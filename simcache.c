@@ -0,0 +1,424 @@
+/*
+ * On-disk cache of simulator output.
+ * Runs ./simulator with the given options and program, keyed by a hash of
+ * the program file, the simulator executable (its build ID) and the
+ * options, and stores stdout and stderr in <cache>/<key>.out:
+ *      E <length>      followed by <length> bytes of stderr, then all of stdout
+ * A later run with the same key replays both without simulating. Only runs
+ * that exit 0 and use options whose whole effect is their output are cached;
+ * the rest are passed through. Either way stdout comes out first, then
+ * stderr, so a hit looks exactly like the miss that filled it. Entries are evicted least recently used first once
+ * the cache grows past its size limit. Counts of hits, misses and
+ * evictions are kept in <cache>/stats (printed by -S); each run adds its
+ * own under a lock, so parallel runs (make -j) don't lose counts.
+ **/
+
+#define _POSIX_C_SOURCE 200809L  // fork, utimensat
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MAXPATHLENGTH 4096
+#define DEFAULTLIMIT 64  // megabytes
+
+typedef struct cacheStatsStruct {
+    unsigned long long hits, misses, evictions, uncached;
+} cacheStatsType;
+
+typedef struct cacheEntryStruct {
+    char name[32];
+    off_t size;
+    struct timespec used;
+} cacheEntryType;
+
+int isEntry(const char*);
+char* readFile(char*, size_t*);
+char* readStream(FILE*, size_t*);
+unsigned long long hashBytes(unsigned long long, const char*, size_t);
+int cacheable(int, char**);
+char* runSimulator(char*, char**, size_t*, char**, size_t*, int*);
+void replay(const char*, size_t, const char*, size_t);
+void writeFile(char*, const char*, size_t);
+int lockStats(FILE*, short);
+void readStats(char*, cacheStatsType*);
+void addStats(char*, cacheStatsType*);
+void evict(char*, unsigned long long, cacheStatsType*);
+
+int main(int argc, char* argv[]) {
+    char* cacheDir = ".simcache";    // -C <dir>: where entries live
+    unsigned long long limit = DEFAULTLIMIT;  // -L <megabytes>: evict down to this size
+    char* simulator = "./simulator";  // -x <path>: the simulator to run
+    int showStats = 0;                // -S: print the cache statistics and exit
+
+    int argi = 1;
+    for (; argi < argc; ++argi) {
+        if (!strcmp(argv[argi], "-C") && argi + 1 < argc) {
+            cacheDir = argv[++argi];
+        } else if (!strcmp(argv[argi], "-L") && argi + 1 < argc) {
+            limit = strtoull(argv[++argi], NULL, 10);
+        } else if (!strcmp(argv[argi], "-x") && argi + 1 < argc) {
+            simulator = argv[++argi];
+        } else if (!strcmp(argv[argi], "-S")) {
+            showStats = 1;
+        } else if (!strcmp(argv[argi], "--")) {
+            ++argi;
+            break;
+        } else {
+            break;
+        }
+    }
+    mkdir(cacheDir, 0777);
+    char statsFile[MAXPATHLENGTH];
+    snprintf(statsFile, sizeof(statsFile), "%s/stats", cacheDir);
+    cacheStatsType stats;  // -S: the totals; otherwise what this run adds to them
+
+    if (showStats) {
+        readStats(statsFile, &stats);
+        unsigned long long entries = 0, bytes = 0;
+        DIR* dir = opendir(cacheDir);
+        struct dirent* ent;
+        while (dir && (ent = readdir(dir)) != NULL) {
+            char path[MAXPATHLENGTH];
+            struct stat info;
+            snprintf(path, sizeof(path), "%s/%s", cacheDir, ent->d_name);
+            if (isEntry(ent->d_name) && !stat(path, &info)) {
+                ++entries;
+                bytes += (unsigned long long)info.st_size;
+            }
+        }
+        if (dir) {
+            closedir(dir);
+        }
+        unsigned long long lookups = stats.hits + stats.misses;
+        printf("%llu hits, %llu misses (%.1f%% hit rate), %llu uncached runs\n", stats.hits, stats.misses,
+               lookups ? 100.0 * (double)stats.hits / (double)lookups : 0.0, stats.uncached);
+        printf("%llu entries, %llu bytes, limit %llu MB, %llu evictions\n", entries, bytes, limit,
+               stats.evictions);
+        return 0;
+    }
+    if (argi >= argc) {
+        printf("error: usage: %s [-C cachedir] [-L megabytes] [-x simulator] [-S] [simulator options] <machine-code file>\n",
+               argv[0]);
+        exit(1);
+    }
+
+    memset(&stats, 0, sizeof(stats));
+
+    // simulator's argv: the simulator itself, then everything after our options
+    char** simArgv = malloc((size_t)(argc - argi + 2) * sizeof(char*));
+    simArgv[0] = simulator;
+    for (int i = argi; i < argc; ++i) {
+        simArgv[i - argi + 1] = argv[i];
+    }
+    simArgv[argc - argi + 1] = NULL;
+
+    size_t length, errorLength;
+    char* errors;
+    int status;
+    if (!cacheable(argc - argi - 1, argv + argi)) {
+        char* output = runSimulator(simulator, simArgv, &length, &errors, &errorLength, &status);
+        replay(output, length, errors, errorLength);
+        ++stats.uncached;
+        addStats(statsFile, &stats);
+        return status;
+    }
+
+    // key: program, simulator build, then the options that change the output, each NUL-terminated
+    size_t size;
+    char* program = readFile(argv[argc - 1], &size);
+    unsigned long long key = hashBytes(0xcbf29ce484222325ull, program, size);
+    free(program);
+    char* build = readFile(simulator, &size);
+    key = hashBytes(key, build, size);
+    free(build);
+    for (int i = argi; i < argc - 1; ++i) {
+        // -F and -j only change how the trace is formatted, never what it says
+        if (!strcmp(argv[i], "-F")) {
+            continue;
+        }
+        if (!strcmp(argv[i], "-j")) {
+            ++i;
+            continue;
+        }
+        key = hashBytes(key, argv[i], strlen(argv[i]) + 1);
+    }
+    char entry[MAXPATHLENGTH];
+    snprintf(entry, sizeof(entry), "%s/%016llx.out", cacheDir, key);
+
+    if (access(entry, R_OK) == 0) {
+        char* stored = readFile(entry, &length);
+        int header = 0;
+        if (sscanf(stored, "E %zu%n", &errorLength, &header) == 1 && stored[header++] == '\n' &&
+            errorLength <= length - (size_t)header) {
+            replay(stored + header + errorLength, length - (size_t)header - errorLength, stored + header,
+                   errorLength);
+            utimensat(AT_FDCWD, entry, NULL, 0);  // mark as recently used
+            ++stats.hits;
+            addStats(statsFile, &stats);
+            return 0;
+        }
+        free(stored);  // not an entry we wrote; simulate and replace it
+    }
+
+    char* output = runSimulator(simulator, simArgv, &length, &errors, &errorLength, &status);
+    replay(output, length, errors, errorLength);
+    ++stats.misses;
+    if (status == 0) {
+        char header[32];
+        int headerLength = snprintf(header, sizeof(header), "E %zu\n", errorLength);
+        char* stored = malloc((size_t)headerLength + errorLength + length);
+        memcpy(stored, header, (size_t)headerLength);
+        memcpy(stored + headerLength, errors, errorLength);
+        memcpy(stored + headerLength + errorLength, output, length);
+        writeFile(entry, stored, (size_t)headerLength + errorLength + length);
+        free(stored);
+        evict(cacheDir, limit << 20, &stats);
+    }
+    addStats(statsFile, &stats);
+    return status;
+}
+
+// is name a cache entry ("<16 hex digits>.out")?
+int isEntry(const char* name) {
+    return strlen(name) == 20 && !strcmp(name + 16, ".out");
+}
+
+// the whole file in one buffer, NUL-terminated (not counted in size)
+char* readFile(char* filename, size_t* size) {
+    FILE* filePtr = fopen(filename, "rb");
+    if (filePtr == NULL) {
+        printf("error: can't open file %s\n", filename);
+        exit(1);
+    }
+    char* buffer = readStream(filePtr, size);
+    fclose(filePtr);
+    return buffer;
+}
+
+// the rest of an open file in one buffer, NUL-terminated (not counted in size)
+char* readStream(FILE* filePtr, size_t* size) {
+    size_t capacity = 1 << 16;
+    char* buffer = malloc(capacity);
+    *size = 0;
+    size_t got;
+    while ((got = fread(buffer + *size, 1, capacity - *size, filePtr)) > 0) {
+        *size += got;
+        if (*size == capacity) {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+        }
+    }
+    buffer[*size] = '\0';
+    return buffer;
+}
+
+// FNV-1a, continuing from hash
+unsigned long long hashBytes(unsigned long long hash, const char* bytes, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ (unsigned char)bytes[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// do these simulator options (before the program) only affect what the simulator prints?
+int cacheable(int numOptions, char** options) {
+    static const char* flags[] = {"-s", "-a", "-F", "-c", "-k"};
+    static const char* withValue[] = {"-m", "-W", "-T", "-K", "-b", "-d", "-j"};
+    for (int i = 0; i < numOptions; ++i) {
+        int known = 0;
+        for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); ++f) {
+            known |= !strcmp(options[i], flags[f]);
+        }
+        for (size_t f = 0; !known && f < sizeof(withValue) / sizeof(withValue[0]); ++f) {
+            if (!strcmp(options[i], withValue[f])) {
+                known = 1;
+                ++i;
+            }
+        }
+        if (!known) {
+            return 0;  // writes or reads another file (-w, -p, -G, -V, -P, -B)
+        }
+    }
+    return 1;
+}
+
+// run the simulator with stdout and stderr captured; returns stdout and sets its length,
+// the stderr text and its length, and the exit status
+char* runSimulator(char* simulator, char** simArgv, size_t* length, char** errors, size_t* errorLength,
+                   int* status) {
+    fflush(stdout);
+    fflush(stderr);
+    int fds[2];
+    FILE* errorFile = tmpfile();  // a second pipe would need poll() to drain both
+    if (errorFile == NULL) {
+        perror("tmpfile");
+        exit(1);
+    }
+    if (pipe(fds)) {
+        perror("pipe");
+        exit(1);
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fileno(errorFile), STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execv(simulator, simArgv);
+        perror(simulator);
+        _exit(127);
+    }
+    close(fds[1]);
+    size_t capacity = 1 << 16;
+    char* output = malloc(capacity);
+    *length = 0;
+    ssize_t got;
+    while ((got = read(fds[0], output + *length, capacity - *length)) > 0) {
+        *length += (size_t)got;
+        if (*length == capacity) {
+            capacity *= 2;
+            output = realloc(output, capacity);
+        }
+    }
+    close(fds[0]);
+    int wstatus;
+    waitpid(pid, &wstatus, 0);
+    *status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 1;
+    rewind(errorFile);
+    *errors = readStream(errorFile, errorLength);
+    fclose(errorFile);
+    return output;
+}
+
+// write a run's output the way every run does: all of stdout, then all of stderr
+void replay(const char* output, size_t length, const char* errors, size_t errorLength) {
+    fwrite(output, 1, length, stdout);
+    fflush(stdout);
+    fwrite(errors, 1, errorLength, stderr);
+}
+
+// written under a temporary name first, so a reader never sees half an entry
+void writeFile(char* filename, const char* bytes, size_t length) {
+    char temp[MAXPATHLENGTH];
+    snprintf(temp, sizeof(temp), "%s.%ld", filename, (long)getpid());
+    FILE* filePtr = fopen(temp, "wb");
+    if (filePtr == NULL) {
+        return;  // a cache that can't be written just doesn't cache
+    }
+    int ok = fwrite(bytes, 1, length, filePtr) == length;
+    ok &= fclose(filePtr) == 0;
+    if (!ok || rename(temp, filename)) {
+        remove(temp);
+    }
+}
+
+// wait for a lock of the given type (F_RDLCK or F_WRLCK) on the whole file; it goes away with fclose
+int lockStats(FILE* filePtr, short type) {
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+    return fcntl(fileno(filePtr), F_SETLKW, &lock) == 0;
+}
+
+void readStats(char* filename, cacheStatsType* stats) {
+    memset(stats, 0, sizeof(*stats));
+    FILE* filePtr = fopen(filename, "r");
+    if (filePtr == NULL) {
+        return;
+    }
+    if (!lockStats(filePtr, F_RDLCK) ||
+        fscanf(filePtr, "%llu %llu %llu %llu", &stats->hits, &stats->misses, &stats->evictions,
+               &stats->uncached) != 4) {
+        memset(stats, 0, sizeof(*stats));
+    }
+    fclose(filePtr);
+}
+
+// add counts to the totals in filename, rewriting it in place while holding the lock
+void addStats(char* filename, cacheStatsType* counts) {
+    int fd = open(filename, O_RDWR | O_CREAT, 0666);
+    FILE* filePtr = fd < 0 ? NULL : fdopen(fd, "r+");
+    if (filePtr == NULL) {
+        return;  // statistics are best effort, like the entries
+    }
+    cacheStatsType stats;
+    if (!lockStats(filePtr, F_WRLCK)) {
+        fclose(filePtr);
+        return;
+    }
+    if (fscanf(filePtr, "%llu %llu %llu %llu", &stats.hits, &stats.misses, &stats.evictions, &stats.uncached) != 4) {
+        memset(&stats, 0, sizeof(stats));
+    }
+    rewind(filePtr);
+    fprintf(filePtr, "%llu %llu %llu %llu\n", stats.hits + counts->hits, stats.misses + counts->misses,
+            stats.evictions + counts->evictions, stats.uncached + counts->uncached);
+    fflush(filePtr);
+    if (ftruncate(fd, ftell(filePtr))) {
+        perror(filename);
+    }
+    fclose(filePtr);
+}
+
+static int olderFirst(const void* a, const void* b) {
+    const struct timespec* x = &((const cacheEntryType*)a)->used;
+    const struct timespec* y = &((const cacheEntryType*)b)->used;
+    if (x->tv_sec != y->tv_sec) {
+        return x->tv_sec < y->tv_sec ? -1 : 1;
+    }
+    return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+// delete the least recently used entries until the cache fits in limit bytes
+void evict(char* cacheDir, unsigned long long limit, cacheStatsType* stats) {
+    DIR* dir = opendir(cacheDir);
+    if (dir == NULL) {
+        return;
+    }
+    int capacity = 64, numEntries = 0;
+    cacheEntryType* entries = malloc((size_t)capacity * sizeof(cacheEntryType));
+    unsigned long long total = 0;
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != NULL) {
+        char path[MAXPATHLENGTH];
+        struct stat info;
+        if (!isEntry(ent->d_name)) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", cacheDir, ent->d_name);
+        if (stat(path, &info)) {
+            continue;
+        }
+        if (numEntries == capacity) {
+            capacity *= 2;
+            entries = realloc(entries, (size_t)capacity * sizeof(cacheEntryType));
+        }
+        strcpy(entries[numEntries].name, ent->d_name);
+        entries[numEntries].size = info.st_size;
+        entries[numEntries].used = info.st_mtim;
+        total += (unsigned long long)info.st_size;
+        ++numEntries;
+    }
+    closedir(dir);
+
+    qsort(entries, (size_t)numEntries, sizeof(cacheEntryType), olderFirst);
+    for (int i = 0; i < numEntries && total > limit; ++i) {
+        char path[MAXPATHLENGTH];
+        snprintf(path, sizeof(path), "%s/%s", cacheDir, entries[i].name);
+        if (!remove(path)) {
+            total -= (unsigned long long)entries[i].size;
+            ++stats->evictions;
+        }
+    }
+    free(entries);
+}
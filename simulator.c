@@ -5,106 +5,205 @@
  * Make sure NOT to modify printState or any of the associated functions
  **/
 
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-// Machine Definitions
-#define NUMMEMORY 65536  // maximum number of data words in memory
-#define NUMREGS 8        // number of machine registers
-
-#define ADD 0
-#define NOR 1
-#define LW 2
-#define SW 3
-#define BEQ 4
-#define JALR 5  // will not implemented for Project 3
-#define HALT 6
-#define NOOP 7
-
-const char* opcode_to_str_map[] = {
-    "add",
-    "nor",
-    "lw",
-    "sw",
-    "beq",
-    "jalr",
-    "halt",
-    "noop"};
-
-#define NOOPINSTR (NOOP << 22)
-
-typedef struct IFIDStruct {
-    int pcPlus1;
-    int instr;
-} IFIDType;
+#include "bintrace.h"
+#include "fastprint.h"
+#include "pipeline.h"
 
-typedef struct IDEXStruct {
-    int pcPlus1;
-    int valA;
-    int valB;
-    int offset;
-    int instr;
-} IDEXType;
+// Loop acceleration
+#define ACCELMAXCYCLES 1024  // longest loop iteration (in cycles) we try to skip
+#define ACCELFIELDS 21       // number of integer fields in a loop snapshot
 
-typedef struct EXMEMStruct {
-    int branchTarget;
-    int eq;
-    int aluResult;
-    int valB;
-    int instr;
-} EXMEMType;
+typedef struct loopAccelStruct {
+    int numSnaps;                                // back-edge snapshots collected for the current loop
+    int key[6];                                  // pc and every pipeline instruction at the back-edge
+    unsigned int snap[2][ACCELFIELDS];           // state at the last two back-edges
+    int length[2];                               // cycles of the last complete and the current iteration
+    int cur;                                     // which trace holds the current iteration
+    cycleInfoType trace[2][ACCELMAXCYCLES];
+    unsigned long long skipped;                  // iterations skipped so far
+} loopAccelType;
 
-typedef struct MEMWBStruct {
-    int writeData;
-    int instr;
-} MEMWBType;
+void readMachineCode(stateType*, char*);
 
-typedef struct WBENDStruct {
-    int writeData;
+// Infinite loop detection
+#define LOOPTABLESIZE 256  // recent state hashes remembered (power of two)
+#define LOOPHASHFIELDS 25  // pc, registers and every pipeline register field
+
+typedef struct loopCheckStruct {
+    unsigned long long hash;                  // hash of the whole machine state except cycles
+    unsigned long long recentHash[LOOPTABLESIZE];
+    unsigned int recentCycle[LOOPTABLESIZE];
+    int candidate;                            // waiting to confirm a suspected repeat
+    unsigned int candidateCycle;              // cycle at which the snapshot was taken
+    unsigned int targetCycle;                 // cycle at which the state should repeat
+    int minPc, maxPc;                         // pcs seen while confirming
+    stateType snapshot;
+} loopCheckType;
+
+// Golden digests
+#define DIGESTANCHORINTERVAL 1024  // cycles between full-text anchors
+
+typedef struct digestStruct {
+    FILE* file;
+    int verify;                 // 1: compare against file, 0: write file
+    unsigned int cycles;        // cycle of the last block hashed
+    unsigned int anchorCycle;   // verify: latest anchor seen in the file
+    long anchorOffset;
+    size_t anchorLength;
+    fastFormatType format;      // printState text of the current block goes to text
+    char* text;
+    size_t textCapacity;
+    size_t textLength;
+} digestType;
+
+// Lockstep co-simulation against an ISA-level reference model
+#define COSIMPENDING 4  // sw instructions past MEM that have not retired yet
+
+typedef struct cosimStruct {
+    int pc;
+    int reg[NUMREGS];
+    int mem[NUMMEMORY];
+    int pendingAddr[COSIMPENDING];  // stores done by the pipeline's MEM stage, oldest first
+    int pendingData[COSIMPENDING];
+    int numPending;
+    unsigned long long retired;
+} cosimType;
+
+// VCD waveform export
+#define VCDSIGNALS 29          // pc, registers, pipeline register fields and strobes
+#define VCDBUFFER (1 << 16)    // bytes buffered before each write
+
+typedef struct vcdStruct {
+    FILE* file;
+    char buffer[VCDBUFFER];
+    size_t length;
+    int started;                       // initial values have been dumped
+    unsigned int last[VCDSIGNALS];     // values as of the previous dump
+} vcdType;
+
+// Pipe trace tables
+#define PIPEROWS 8            // instructions in flight or waiting to be printed
+#define PIPEROWCELLS 16       // cycles one instruction can spend in the pipeline
+#define PIPESTALL 0x10        // cell flag: held by a load-use stall
+#define PIPESQUASH 0x20       // cell flag: discarded by a taken branch
+
+typedef struct pipeRowStruct {
+    int pc;
     int instr;
-} WBENDType;
+    int done;                          // left the pipeline, ready to print
+    unsigned int firstCycle;
+    int numCells;
+    unsigned char cells[PIPEROWCELLS];  // stage (1 = IF .. 5 = WB) plus flags, one per cycle
+} pipeRowType;
 
-typedef struct stateStruct {
+typedef struct pipeTraceStruct {
+    FILE* file;
+    int csv;
+    unsigned int first, last;          // cycle window [first, last)
+    pipeRowType rows[PIPEROWS];        // row of instruction n is rows[n % PIPEROWS]
+    long long fetch;                   // instruction in IF, -1 if none yet
+    long long tags[4];                 // instructions in IFID, IDEX, EXMEM and MEMWB, -1 for bubbles
+    long long numRows;                 // instructions fetched
+    long long numPrinted;              // rows are printed in fetch order
+} pipeTraceType;
+
+// Branch profiles
+typedef struct branchProfileStruct {
+    unsigned long long taken[NUMMEMORY];     // per beq pc, counted when it resolves in MEM
+    unsigned long long notTaken[NUMMEMORY];
+} branchProfileType;
+
+// Threaded trace formatting
+#define TRACERING 16               // batches in flight
+#define TRACEMAXTHREADS 16
+#define TRACEBATCHMAX 256          // records per batch
+#define TRACEBATCHBYTES (4 << 20)  // formatted text one batch may take
+
+typedef struct traceRecordStruct {
+    unsigned int cycles;
     int pc;
-    int instrMem[NUMMEMORY];
-    int dataMem[NUMMEMORY];
     int reg[NUMREGS];
-    unsigned int numMemory;
     IFIDType IFID;
     IDEXType IDEX;
     EXMEMType EXMEM;
     MEMWBType MEMWB;
     WBENDType WBEND;
-    unsigned int cycles;  // number of cycles run so far
-} stateType;
+    int writeAddr;                 // stored to by the cycle before this one, -1 if none
+    int writeData;
+} traceRecordType;
 
-static inline int opcode(int instruction) {
-    return instruction >> 22;
-}
+typedef struct traceBatchStruct {
+    int numRecords;
+    int* memory;                   // dataMem as of the first record
+    traceRecordType* records;      // consecutive cycles
+} traceBatchType;
 
-static inline int field0(int instruction) {
-    return (instruction >> 19) & 0x7;
-}
+typedef struct traceWorkerStruct {
+    struct traceThreadsStruct* threads;
+    int index;                     // formats batches index, index + numThreads, ...
+    pthread_t thread;
+} traceWorkerType;
 
-static inline int field1(int instruction) {
-    return (instruction >> 16) & 0x7;
-}
+typedef struct traceThreadsStruct {
+    int numThreads;
+    int batchSize;
+    int numMemory;
+    traceBatchType ring[TRACERING];  // batch n is ring[n % TRACERING]
+    unsigned long long produced;     // batches handed to the formatters
+    unsigned long long written;      // batches written to stdout, in order
+    int done;                        // no more batches are coming
+    unsigned int lastCycle;          // cycle of the last record
+    int writeAddr, writeData;        // sw of the last simulated cycle
+    traceWorkerType workers[TRACEMAXTHREADS];
+} traceThreadsType;
 
-static inline int field2(int instruction) {
-    return instruction & 0xFFFF;
-}
+// Hazard coverage
+#define COVERFORWARDA 0       // + source - 1: regA forwarded from EXMEM, MEMWB, WBEND
+#define COVERFORWARDB 3       // regB of add, nor or beq
+#define COVERFORWARDSW 6      // the data a sw stores
+#define COVERSTALL 9          // + consumer opcode (add .. beq): load-use stall
+#define COVERNOTTAKEN 14
+#define COVERTAKEN 15         // + mask of squashed stages holding instructions (1 IF, 2 ID, 4 EX)
+#define COVEREVENTS 23
 
-// convert a 16-bit number into a 32-bit Linux integer
-static inline int convertNum(int num) {
-    return num - ((num & (1 << 15)) ? 1 << 16 : 0);
-}
+typedef struct coverageStruct {
+    unsigned long long count[COVEREVENTS];
+} coverageType;
 
-void printState(stateType*);
-void printInstruction(int);
-void readMachineCode(stateType*, char*);
-int getRegValue(stateType*, int, int);
-int isRegUsed(int, int);
+int accelCycle(loopAccelType*, stateType*, cycleInfoType*, unsigned int);
+void loopCheckInit(loopCheckType*, stateType*);
+void loopCheckCycle(loopCheckType*, stateType*, stateType*, cycleInfoType*);
+void cosimInit(cosimType*, stateType*);
+void cosimCycle(cosimType*, stateType*, stateType*, cycleInfoType*);
+void cosimHalt(cosimType*, stateType*);
+void vcdOpen(vcdType*, char*);
+void vcdState(vcdType*, stateType*, cycleInfoType*);
+void vcdClose(vcdType*);
+void pipeTraceOpen(pipeTraceType*, char*, unsigned int, unsigned int);
+void pipeTraceCycle(pipeTraceType*, stateType*, cycleInfoType*);
+void pipeTraceClose(pipeTraceType*);
+void digestOpen(digestType*, char*, int);
+void digestState(digestType*, stateType*);
+void digestClose(digestType*);
+void profileCycle(branchProfileType*, stateType*, cycleInfoType*);
+void profileWrite(branchProfileType*, char*);
+void parseAddresses(char*, unsigned int*);
+void debugHit(stateType*, cycleInfoType*, int);
+void traceThreadsStart(traceThreadsType*, int, int);
+void traceThreadsState(traceThreadsType*, stateType*);
+void traceThreadsCycle(traceThreadsType*, cycleInfoType*);
+void traceThreadsDrain(traceThreadsType*);
+void traceThreadsFinish(traceThreadsType*);
+void binTraceAtExit(binTraceType*);
+void coverageCycle(coverageType*, stateType*, cycleInfoType*);
+void coverageWrite(coverageType*, char*);
 
 int main(int argc, char* argv[]) {
     /* Declare state and newState.
@@ -112,335 +211,1402 @@ int main(int argc, char* argv[]) {
        dataMem are not allocated on the stack. */
 
     static stateType state, newState;
+    static loopAccelType accel;
+    static loopCheckType loopCheck;
+    static cosimType cosim;
+    static vcdType vcd;
+    static pipeTraceType pipeTrace;
+    static branchProfileType profile;
+    static unsigned int breakpoints[NUMMEMORY / 32], watchpoints[NUMMEMORY / 32];
+    static traceThreadsType traceThreads;
+    static binTraceType binTrace;
+    static coverageType coverage;
+    digestType digest;
 
-    if (argc != 2) {
-        printf("error: usage: %s <machine-code file>\n", argv[0]);
+    int silent = 0;                // -s: only print the final state
+    int accelerate = 0;            // -a: skip steady-state loop iterations (implies -s)
+    unsigned int maxCycles = 0;    // -m <cycles>: give up after this many cycles (0 = never)
+    int check = 0;                 // -c: check every retiring instruction against a reference model
+    char* vcdFile = NULL;          // -w <file>: write a VCD waveform of the pipeline
+    char* pipeFile = NULL;         // -p <file>: write a pipe trace table (CSV if file ends in .csv)
+    unsigned int windowFirst = 0;  // -W <first>:<last>: cycles covered by the pipe trace
+    unsigned int windowLast = 64;
+    char* digestFile = NULL;       // -G <file>: write a golden digest, -V <file>: verify against one
+    int verify = 0;
+    char* profileFile = NULL;      // -P <file>: write per-beq taken/not-taken counts
+    unsigned int traceFirst = 0;   // -T <first>:[<last>]: only print the blocks of cycles [first, last)
+    unsigned int traceLast = UINT_MAX;
+    unsigned int traceEvery = 1;   // -K <k>: only print every k-th of those blocks
+    int fast = 0;                  // -F: print the trace with fastPrintState
+    int keepGoing = 0;             // -k: report breakpoints (-b <pcs>) and watchpoints (-d <addrs>) without stopping
+    int numThreads = 0;            // -j <threads>: format the trace on this many threads
+    char* binFile = NULL;          // -B <file>: write a binary trace with a cycle index (see traceview)
+    char* coverageFile = NULL;     // -H <file>: write which hazards and forwarding paths were exercised
+    int argi = 1;
+    for (; argi < argc - 1 && argv[argi][0] == '-'; ++argi) {
+        if (!strcmp(argv[argi], "-s")) {
+            silent = 1;
+        } else if (!strcmp(argv[argi], "-a")) {
+            silent = accelerate = 1;
+        } else if (!strcmp(argv[argi], "-c")) {
+            check = 1;
+        } else if (!strcmp(argv[argi], "-w") && argi + 1 < argc - 1) {
+            vcdFile = argv[++argi];
+        } else if (!strcmp(argv[argi], "-p") && argi + 1 < argc - 1) {
+            pipeFile = argv[++argi];
+        } else if (!strcmp(argv[argi], "-W") && argi + 1 < argc - 1 &&
+                   sscanf(argv[argi + 1], "%u:%u", &windowFirst, &windowLast) == 2) {
+            ++argi;
+        } else if (!strcmp(argv[argi], "-m") && argi + 1 < argc - 1) {
+            maxCycles = (unsigned int)strtoul(argv[++argi], NULL, 10);
+        } else if ((!strcmp(argv[argi], "-G") || !strcmp(argv[argi], "-V")) && argi + 1 < argc - 1) {
+            verify = argv[argi][1] == 'V';
+            silent |= verify;
+            digestFile = argv[++argi];
+        } else if (!strcmp(argv[argi], "-P") && argi + 1 < argc - 1) {
+            profileFile = argv[++argi];
+        } else if (!strcmp(argv[argi], "-b") && argi + 1 < argc - 1) {
+            parseAddresses(argv[++argi], breakpoints);
+            breakpointMap = breakpoints;
+        } else if (!strcmp(argv[argi], "-d") && argi + 1 < argc - 1) {
+            parseAddresses(argv[++argi], watchpoints);
+            watchpointMap = watchpoints;
+        } else if (!strcmp(argv[argi], "-T") && argi + 1 < argc - 1 &&
+                   sscanf(argv[argi + 1], "%u:%u", &traceFirst, &traceLast) >= 1) {
+            ++argi;
+        } else if (!strcmp(argv[argi], "-K") && argi + 1 < argc - 1 && atoi(argv[argi + 1]) > 0) {
+            traceEvery = (unsigned int)atoi(argv[++argi]);
+        } else if (!strcmp(argv[argi], "-F")) {
+            fast = 1;
+        } else if (!strcmp(argv[argi], "-j") && argi + 1 < argc - 1 && atoi(argv[argi + 1]) > 0 &&
+                   atoi(argv[argi + 1]) <= TRACEMAXTHREADS) {
+            numThreads = atoi(argv[++argi]);
+        } else if (!strcmp(argv[argi], "-B") && argi + 1 < argc - 1) {
+            binFile = argv[++argi];
+        } else if (!strcmp(argv[argi], "-H") && argi + 1 < argc - 1) {
+            coverageFile = argv[++argi];
+        } else if (!strcmp(argv[argi], "-k")) {
+            keepGoing = 1;
+        } else {
+            break;
+        }
+    }
+    if (argi != argc - 1) {
+        printf("error: usage: %s [-s] [-a] [-F] [-j threads] [-c] [-m maxCycles] [-w vcd] [-p pipetrace] [-W first:last] [-G|-V digest] [-P profile] [-B bintrace] [-H coverage] [-T first:[last]] [-K every] [-b pc,...] [-d addr,...] [-k] <machine-code file>\n", argv[0]);
         exit(1);
     }
 
-    readMachineCode(&state, argv[1]);
+    readMachineCode(&state, argv[argi]);
 
     // Initialize state here
 
-    state.cycles = 0;
-    memset(state.reg, 0, sizeof(state.reg));
-    state.pc = 0;
-    state.IFID.instr = NOOPINSTR;
-    state.IDEX.instr = NOOPINSTR;
-    state.EXMEM.instr = NOOPINSTR;
-    state.MEMWB.instr = NOOPINSTR;
-    state.WBEND.instr = NOOPINSTR;
+    initState(&state);
 
     newState = state;
+    loopCheckInit(&loopCheck, &state);
+    if (accelerate && (digestFile || check || vcdFile || pipeFile || profileFile || binFile || coverageFile ||
+                       breakpointMap || watchpointMap)) {
+        printf("error: -a skips cycles and cannot be combined with -c, -w, -p, -G, -V, -P, -B, -H, -b or -d\n");
+        exit(1);
+    }
+    if (accelerate && !maxCycles) {
+        maxCycles = INT_MAX;  // skips must keep the cycle counter printable
+    }
+    if (digestFile) {
+        digestOpen(&digest, digestFile, verify);
+    }
+    if (check) {
+        cosimInit(&cosim, &state);
+    }
+    if (vcdFile) {
+        vcdOpen(&vcd, vcdFile);
+    }
+    if (pipeFile) {
+        pipeTraceOpen(&pipeTrace, pipeFile, windowFirst, windowLast);
+    }
+    if (binFile) {
+        binTraceOpen(&binTrace, binFile, (int)state.numMemory);
+        binTraceAtExit(&binTrace);
+    }
 
+    if (silent) {
+        numThreads = 0;
+    }
+    if (numThreads) {
+        traceThreadsStart(&traceThreads, numThreads, (int)state.numMemory);
+    } else if (fast) {
+        // the trace bypasses stdio from here on; an error exit still gets the blocks before it
+        fflush(stdout);
+        atexit(fastPrintFlush);
+    }
+    int stopped = 0;
     while (opcode(state.MEMWB.instr) != HALT) {
-        printState(&state);
-
-        newState = state;
-
-        newState.cycles += 1;
-
-        /* ---------------------- IF stage --------------------- */
-
-        newState.IFID.instr = state.instrMem[state.pc];
-        newState.IFID.pcPlus1 = state.pc + 1;
-
-        newState.pc = state.pc + 1;
+        if (!silent && state.cycles >= traceFirst && state.cycles < traceLast &&
+            (state.cycles - traceFirst) % traceEvery == 0) {
+            if (numThreads) {
+                traceThreadsState(&traceThreads, &state);
+            } else if (fast) {
+                fastPrintState(&state);
+            } else {
+                printState(&state);
+            }
+        }
+        if (digestFile) {
+            digestState(&digest, &state);
+        }
+        if (binFile) {
+            binTraceState(&binTrace, &state);
+        }
+        cycleInfoType info;
 
-        /* ---------------------- ID stage --------------------- */
-        // You will need to stall for one type of data hazard: a lw followed by an instruction that uses the register being loaded.
+        simulateCycle(&state, &newState, &info);
+        if (numThreads) {
+            traceThreadsCycle(&traceThreads, &info);
+        }
+        if (binFile) {
+            binTraceCycle(&binTrace, &info);
+        }
+        if (info.hit) {
+            if (numThreads) {
+                traceThreadsDrain(&traceThreads);
+            }
+            fastPrintFlush();
+            debugHit(&state, &info, silent);
+            fflush(stdout);
+            if (!keepGoing) {
+                stopped = 1;
+                break;
+            }
+        }
+        if (check) {
+            cosimCycle(&cosim, &state, &newState, &info);
+        }
+        if (vcdFile) {
+            vcdState(&vcd, &state, &info);
+        }
+        if (pipeFile) {
+            pipeTraceCycle(&pipeTrace, &state, &info);
+        }
+        if (profileFile) {
+            profileCycle(&profile, &state, &info);
+        }
+        if (coverageFile) {
+            coverageCycle(&coverage, &state, &info);
+        }
 
-        if (opcode(state.IDEX.instr) == LW && isRegUsed(state.IFID.instr, field1(state.IDEX.instr))) {
-            newState.IDEX.instr = NOOPINSTR;
-            newState.pc = state.pc;
-            newState.IFID = state.IFID;
-        } else {
-            newState.IDEX.instr = state.IFID.instr;
-            newState.IDEX.valA = state.reg[field0(state.IFID.instr)];
-            newState.IDEX.valB = state.reg[field1(state.IFID.instr)];
-            newState.IDEX.pcPlus1 = state.IFID.pcPlus1;
-            newState.IDEX.offset = convertNum(field2(state.IFID.instr));
-        }
-
-        /* ---------------------- EX stage --------------------- */
-        /*
-        Use data forwarding to resolve most data hazards.
-        The ALU should be able to take its inputs from any pipeline register
-        (instead of just the IDEX register).
-        To account for a lack of internal forwarding within the register file,
-        you’ll instead forward data from the new WBEND pipeline register.
-        Remember to take the most recent data
-        (e.g., data in the EXMEM register gets priority over data in the MEMWB register).
-        ONLY FORWARD DATA TO THE EX STAGE (not to memory).
-        */
-
-        newState.EXMEM.branchTarget = state.IDEX.pcPlus1 + state.IDEX.offset;
-        int alu1In = getRegValue(&state, field0(state.IDEX.instr), state.IDEX.valA), alu2In = 0;
-        if (opcode(state.IDEX.instr) <= NOR || opcode(state.IDEX.instr) == BEQ)
-            alu2In = getRegValue(&state, field1(state.IDEX.instr), state.IDEX.valB);
-        else
-            alu2In = state.IDEX.offset;
-        newState.EXMEM.eq = (alu2In == alu1In);
-        int aluOp = opcode(state.IDEX.instr) == NOR;
-        if (aluOp == 0)
-            newState.EXMEM.aluResult = alu1In + alu2In;
-        else
-            newState.EXMEM.aluResult = ~(alu2In | alu1In);
-        newState.EXMEM.valB = getRegValue(&state, field1(state.IDEX.instr), state.IDEX.valB);
-        newState.EXMEM.instr = state.IDEX.instr;
-        // printf("========================= ALU: %d %d %d\n", alu1In, alu2In, alu1In == alu2In);
-
-        /* --------------------- MEM stage --------------------- */
-        /*Predict branch-not-taken to speculate on branches,
-        and decide whether or not to take the branch in the MEM stage.
-        This requires you to discard instructions if it turns out
-        that the branch prediction was incorrect.
-        To discard instructions, change the relevant instructions
-        in the pipeline to the noop instruction (0x1c00000).
-         */
-        int opMem = opcode(state.EXMEM.instr);
-        if (opMem == SW) {
-            // newState.MEMWB.writeData = state.EXMEM.valB;
-            newState.dataMem[state.EXMEM.aluResult] = state.EXMEM.valB;
-        } else if (opMem == LW) {
-            newState.MEMWB.writeData = state.dataMem[state.EXMEM.aluResult];
-        } else if (opMem <= NOR) {
-            newState.MEMWB.writeData = state.EXMEM.aluResult;
-        }
-        if (opMem == BEQ && state.EXMEM.eq) {
-            newState.pc = state.EXMEM.branchTarget;
-            newState.IFID.instr = NOOPINSTR;
-            newState.IDEX.instr = NOOPINSTR;
-            newState.EXMEM.instr = NOOPINSTR;
-        }
-        newState.MEMWB.instr = state.EXMEM.instr;
-        /* ---------------------- WB stage --------------------- */
-        // the starter code stops when the halt instruction reaches the MEMWB register.
-        int opWb = opcode(state.MEMWB.instr);
-        if (opWb == LW) {
-            newState.reg[field1(state.MEMWB.instr)] = state.MEMWB.writeData;
-        }
-        // else if (opWb == SW) {
-        //     newState.dataMem[state.reg[field0(state.MEMWB.instr)] + field2(state.MEMWB.instr)] = state.MEMWB.writeData;
-        // }
-        else if (opWb <= NOR) {
-            newState.reg[field2(state.MEMWB.instr)] = state.MEMWB.writeData;
-        }
-        newState.WBEND.writeData = state.MEMWB.writeData;
-        newState.WBEND.instr = state.MEMWB.instr;
-
-        /* ------------------------ END ------------------------ */
+        if (accelerate) {
+            accelCycle(&accel, &newState, &info, maxCycles);
+        }
+        // a skip only moves fields loopCheckCycle rehashes, so the check keeps its history across it
+        loopCheckCycle(&loopCheck, &state, &newState, &info);
+        if (maxCycles && newState.cycles >= maxCycles && opcode(newState.MEMWB.instr) != HALT) {
+            printf("error: no halt after %u cycles (pc = %d)\n", newState.cycles, newState.pc);
+            exit(1);
+        }
         state = newState; /* this is the last statement before end of the loop. It marks the end
         of the cycle and updates the current state with the values calculated in this cycle */
     }
+    if (numThreads) {
+        traceThreadsFinish(&traceThreads);
+    }
+    fastPrintFlush();
+    if (accelerate) {
+        fprintf(stderr, "loop acceleration skipped %llu iterations\n", accel.skipped);
+    }
+    if (digestFile && !stopped) {
+        digestState(&digest, &state);
+        digestClose(&digest);
+    }
+    if (check && !stopped) {
+        cosimHalt(&cosim, &state);
+    }
+    if (vcdFile) {
+        cycleInfoType idle = {NOOPINSTR, {0, 0}, NOOPINSTR, 0, 0, 0, 0, {FORWARDNONE, FORWARDNONE}};
+        vcdState(&vcd, &state, &idle);
+        vcdClose(&vcd);
+    }
+    if (pipeFile) {
+        pipeTraceClose(&pipeTrace);
+    }
+    if (profileFile) {
+        profileWrite(&profile, profileFile);
+    }
+    if (coverageFile) {
+        coverageWrite(&coverage, coverageFile);
+    }
+    if (binFile) {
+        if (!stopped) {
+            binTraceState(&binTrace, &state);
+        }
+        binTraceClose(&binTrace);
+    }
+    if (stopped) {
+        printf("Machine stopped before cycle %u\n", state.cycles);
+        return 0;
+    }
     printf("Machine halted\n");
     printf("Total of %d cycles executed\n", state.cycles);
     printf("Final state of machine:\n");
     printState(&state);
 }
 
+// File
+#define MAXLINELENGTH 1000  // MAXLINELENGTH is the max number of characters we read
+
+void readMachineCode(stateType* state, char* filename) {
+    char line[MAXLINELENGTH];
+    FILE* filePtr = fopen(filename, "r");
+    if (filePtr == NULL) {
+        printf("error: can't open file %s", filename);
+        exit(1);
+    }
+
+    printf("instruction memory:\n");
+    for (state->numMemory = 0; fgets(line, MAXLINELENGTH, filePtr) != NULL; ++state->numMemory) {
+        if (sscanf(line, "%d", state->instrMem + state->numMemory) != 1) {
+            printf("error in reading address %d\n", state->numMemory);
+            exit(1);
+        }
+        printf("\tinstrMem[ %d ]\t= 0x%08x\t= %d\t= ", state->numMemory,
+               state->instrMem[state->numMemory], state->instrMem[state->numMemory]);
+        printInstruction(state->dataMem[state->numMemory] = state->instrMem[state->numMemory]);
+        printf("\n");
+    }
+}
+
+/*
+ * Loop acceleration.
+ * At every taken backward beq we snapshot the machine. Once three consecutive
+ * back-edges see the same pc and pipeline instructions, the same per-iteration
+ * change in every field, and iterations whose non-linear inputs (nor operands,
+ * lw/sw addresses and data) do not change, every further iteration is known to
+ * add the same delta. We then jump ahead to just before the first iteration in
+ * which some ALU equality test (and therefore a beq) would change its outcome.
+ **/
+
+// collect pointers to every integer field that may change from one iteration to the next
+static void accelFields(stateType* state, unsigned int* fields[ACCELFIELDS]) {
+    int n = 0;
+    fields[n++] = (unsigned int*)&state->pc;
+    for (int i = 0; i < NUMREGS; ++i) {
+        fields[n++] = (unsigned int*)&state->reg[i];
+    }
+    fields[n++] = (unsigned int*)&state->IFID.pcPlus1;
+    fields[n++] = (unsigned int*)&state->IDEX.pcPlus1;
+    fields[n++] = (unsigned int*)&state->IDEX.valA;
+    fields[n++] = (unsigned int*)&state->IDEX.valB;
+    fields[n++] = (unsigned int*)&state->IDEX.offset;
+    fields[n++] = (unsigned int*)&state->EXMEM.branchTarget;
+    fields[n++] = (unsigned int*)&state->EXMEM.eq;
+    fields[n++] = (unsigned int*)&state->EXMEM.aluResult;
+    fields[n++] = (unsigned int*)&state->EXMEM.valB;
+    fields[n++] = (unsigned int*)&state->MEMWB.writeData;
+    fields[n++] = (unsigned int*)&state->WBEND.writeData;
+    fields[n++] = &state->cycles;
+}
+
+// smallest n >= 1 for which (diff + n * step == 0) differs from (diff == 0), or UINT_MAX if never
+static unsigned int accelFirstFlip(unsigned int diff, unsigned int step) {
+    if (step == 0) {
+        return UINT_MAX;
+    }
+    if (diff == 0) {
+        return 1;
+    }
+    // solve step * n == -diff (mod 2^32)
+    unsigned int target = 0u - diff;
+    int shift = 0;
+    while (!((step >> shift) & 1)) {
+        ++shift;
+    }
+    if (target & ((1u << shift) - 1)) {
+        return UINT_MAX;
+    }
+    unsigned int odd = step >> shift, inverse = odd;
+    for (int i = 0; i < 5; ++i) {
+        inverse *= 2 - odd * inverse;
+    }
+    unsigned long long modulus = 1ull << (32 - shift);
+    unsigned long long n = ((target >> shift) * inverse) & (modulus - 1);
+    return n > UINT_MAX ? UINT_MAX : (unsigned int)n;
+}
+
+// number of further iterations that behave exactly like the last one, 0 if the loop is not steady
+static unsigned int accelSteadyIterations(loopAccelType* accel, unsigned int* now) {
+    int prev = !accel->cur;
+    if (accel->length[0] != accel->length[1]) {
+        return 0;
+    }
+    for (int i = 0; i < ACCELFIELDS; ++i) {
+        if (accel->snap[1][i] - accel->snap[0][i] != now[i] - accel->snap[1][i]) {
+            return 0;
+        }
+    }
+    unsigned int limit = UINT_MAX;
+    for (int c = 0; c < accel->length[0]; ++c) {
+        cycleInfoType* a = &accel->trace[prev][c];
+        cycleInfoType* b = &accel->trace[accel->cur][c];
+        if (a->exInstr != b->exInstr || a->memInstr != b->memInstr || a->branchTaken != b->branchTaken) {
+            return 0;
+        }
+        unsigned int stepA = (unsigned int)b->aluIn[0] - (unsigned int)a->aluIn[0];
+        unsigned int stepB = (unsigned int)b->aluIn[1] - (unsigned int)a->aluIn[1];
+        if (opcode(b->exInstr) == NOR && (stepA || stepB)) {
+            return 0;
+        }
+        unsigned int flip = accelFirstFlip((unsigned int)b->aluIn[0] - (unsigned int)b->aluIn[1], stepA - stepB);
+        if (flip - 1 < limit) {
+            limit = flip - 1;
+        }
+        int opMem = opcode(b->memInstr);
+        if ((opMem == LW || opMem == SW) && (a->memAddr != b->memAddr || a->memData != b->memData)) {
+            return 0;
+        }
+    }
+    return limit;
+}
+
+// returns 1 if newState was moved ahead by some number of iterations, never past cycle maxCycles
+int accelCycle(loopAccelType* accel, stateType* newState, cycleInfoType* info, unsigned int maxCycles) {
+    if (accel->numSnaps > 0) {
+        if (accel->length[accel->cur] == ACCELMAXCYCLES) {
+            accel->numSnaps = 0;
+        } else {
+            accel->trace[accel->cur][accel->length[accel->cur]++] = *info;
+        }
+    }
+    if (!info->branchTaken || convertNum(field2(info->memInstr)) >= 0) {
+        return 0;
+    }
+
+    int key[6] = {newState->pc, newState->IFID.instr, newState->IDEX.instr,
+                  newState->EXMEM.instr, newState->MEMWB.instr, newState->WBEND.instr};
+    unsigned int* fields[ACCELFIELDS];
+    unsigned int now[ACCELFIELDS];
+    accelFields(newState, fields);
+    for (int i = 0; i < ACCELFIELDS; ++i) {
+        now[i] = *fields[i];
+    }
+
+    if (accel->numSnaps == 0 || memcmp(key, accel->key, sizeof(key))) {
+        memcpy(accel->key, key, sizeof(key));
+        memcpy(accel->snap[1], now, sizeof(now));
+        accel->numSnaps = 1;
+        accel->length[accel->cur] = 0;
+        return 0;
+    }
+    if (accel->numSnaps == 2) {
+        unsigned int skip = accelSteadyIterations(accel, now);
+        unsigned int cycleStep = now[ACCELFIELDS - 1] - accel->snap[1][ACCELFIELDS - 1];
+        unsigned int maxSkip = now[ACCELFIELDS - 1] < maxCycles ? (maxCycles - now[ACCELFIELDS - 1]) / cycleStep : 0;
+        if (skip > maxSkip) {
+            skip = maxSkip;
+        }
+        if (skip > 0) {
+            for (int i = 0; i < ACCELFIELDS; ++i) {
+                *fields[i] = now[i] + skip * (now[i] - accel->snap[1][i]);
+            }
+            accel->skipped += skip;
+            accel->numSnaps = 0;
+            return 1;
+        }
+    }
+    memcpy(accel->snap[0], accel->snap[1], sizeof(now));
+    memcpy(accel->snap[1], now, sizeof(now));
+    accel->numSnaps = 2;
+    accel->cur = !accel->cur;
+    accel->length[accel->cur] = 0;
+    return 0;
+}
+
+/*
+ * Infinite loop detection.
+ * The machine state (everything except cycles) is hashed as a sum of per-field
+ * hashes, so a cycle only has to rehash the fields it changed. A state hash seen
+ * again in the small table of recent hashes is only a suspicion; we snapshot the
+ * state and confirm the repeat with a full comparison one period later, after
+ * which the program provably never halts.
+ **/
+
+static unsigned long long loopHashField(unsigned int field, int value) {
+    unsigned long long x = ((unsigned long long)field << 32) | (unsigned int)value;
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+static void loopHashFields(stateType* state, int* fields[LOOPHASHFIELDS]) {
+    int n = 0;
+    fields[n++] = &state->pc;
+    for (int i = 0; i < NUMREGS; ++i) {
+        fields[n++] = &state->reg[i];
+    }
+    fields[n++] = &state->IFID.instr;
+    fields[n++] = &state->IFID.pcPlus1;
+    fields[n++] = &state->IDEX.instr;
+    fields[n++] = &state->IDEX.pcPlus1;
+    fields[n++] = &state->IDEX.valA;
+    fields[n++] = &state->IDEX.valB;
+    fields[n++] = &state->IDEX.offset;
+    fields[n++] = &state->EXMEM.instr;
+    fields[n++] = &state->EXMEM.branchTarget;
+    fields[n++] = &state->EXMEM.eq;
+    fields[n++] = &state->EXMEM.aluResult;
+    fields[n++] = &state->EXMEM.valB;
+    fields[n++] = &state->MEMWB.instr;
+    fields[n++] = &state->MEMWB.writeData;
+    fields[n++] = &state->WBEND.instr;
+    fields[n++] = &state->WBEND.writeData;
+}
+
+// memory words are hashed after the pipeline fields
+#define LOOPMEMFIELD(addr) (LOOPHASHFIELDS + (unsigned int)(addr))
+
+static int loopSameState(stateType* a, stateType* b) {
+    int* fieldsA[LOOPHASHFIELDS];
+    int* fieldsB[LOOPHASHFIELDS];
+    loopHashFields(a, fieldsA);
+    loopHashFields(b, fieldsB);
+    for (int i = 0; i < LOOPHASHFIELDS; ++i) {
+        if (*fieldsA[i] != *fieldsB[i]) {
+            return 0;
+        }
+    }
+    return !memcmp(a->dataMem, b->dataMem, sizeof(a->dataMem));
+}
+
+void loopCheckInit(loopCheckType* check, stateType* state) {
+    int* fields[LOOPHASHFIELDS];
+    loopHashFields(state, fields);
+    check->hash = 0;
+    for (int i = 0; i < LOOPHASHFIELDS; ++i) {
+        check->hash += loopHashField(i, *fields[i]);
+    }
+    for (int i = 0; i < NUMMEMORY; ++i) {
+        check->hash += loopHashField(LOOPMEMFIELD(i), state->dataMem[i]);
+    }
+    memset(check->recentHash, 0, sizeof(check->recentHash));
+    memset(check->recentCycle, 0, sizeof(check->recentCycle));
+    check->candidate = 0;
+}
+
+void loopCheckCycle(loopCheckType* check, stateType* state, stateType* newState, cycleInfoType* info) {
+    int* oldFields[LOOPHASHFIELDS];
+    int* newFields[LOOPHASHFIELDS];
+    loopHashFields(state, oldFields);
+    loopHashFields(newState, newFields);
+    for (int i = 0; i < LOOPHASHFIELDS; ++i) {
+        if (*oldFields[i] != *newFields[i]) {
+            check->hash += loopHashField(i, *newFields[i]) - loopHashField(i, *oldFields[i]);
+        }
+    }
+    if (opcode(info->memInstr) == SW) {
+        int addr = info->memAddr;
+        check->hash += loopHashField(LOOPMEMFIELD(addr), newState->dataMem[addr]) -
+                       loopHashField(LOOPMEMFIELD(addr), state->dataMem[addr]);
+    }
+
+    unsigned int now = newState->cycles;
+    if (check->candidate) {
+        if (newState->pc < check->minPc) {
+            check->minPc = newState->pc;
+        }
+        if (newState->pc > check->maxPc) {
+            check->maxPc = newState->pc;
+        }
+        if (now == check->targetCycle) {
+            if (loopSameState(&check->snapshot, newState)) {
+                printf("error: infinite loop: state before cycle %u repeats the state before cycle %u "
+                       "(pc loops within %d..%d)\n",
+                       now, check->candidateCycle, check->minPc, check->maxPc);
+                exit(1);
+            }
+            check->candidate = 0;
+        }
+        return;
+    }
+
+    int slot = check->hash & (LOOPTABLESIZE - 1);
+    if (check->recentHash[slot] == check->hash && check->recentCycle[slot] < now) {
+        check->snapshot = *newState;
+        check->candidate = 1;
+        check->candidateCycle = now;
+        check->targetCycle = now + (now - check->recentCycle[slot]);
+        check->minPc = check->maxPc = newState->pc;
+    }
+    check->recentHash[slot] = check->hash;
+    check->recentCycle[slot] = now;
+}
+
+/*
+ * Golden digests.
+ * A digest stores one 64-bit hash of every printState block instead of the
+ * block itself, plus the full text of every DIGESTANCHORINTERVAL-th block and
+ * of the final one:
+ *      LC2K-DIGEST 1
+ *      A <cycle> <length>      followed by <length> bytes of printState text
+ *      H <hash>                one per cycle, in order
+ *      E <cycles>              the cycle the machine halted at
+ * Verification reads it sequentially, so memory use does not grow with the
+ * length of the run.
+ **/
+
+static unsigned long long digestHash(const char* text, size_t length) {
+    unsigned long long hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ (unsigned char)text[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// format the printState block for state into digest->text
+static void digestCapture(digestType* digest, stateType* state) {
+    size_t size = fastStateSize((int)state->numMemory);
+    if (size > digest->textCapacity) {
+        digest->text = realloc(digest->text, size);
+        digest->textCapacity = size;
+    }
+    digest->textLength = (size_t)(fastFormatState(&digest->format, digest->text, state) - digest->text);
+}
+
+void digestOpen(digestType* digest, char* filename, int verify) {
+    digest->verify = verify;
+    digest->file = fopen(filename, verify ? "r" : "w");
+    if (digest->file == NULL) {
+        printf("error: can't open file %s\n", filename);
+        exit(1);
+    }
+    memset(&digest->format, 0, sizeof(digest->format));
+    digest->text = NULL;
+    digest->textCapacity = 0;
+    digest->anchorOffset = -1;
+    if (!verify) {
+        fprintf(digest->file, "LC2K-DIGEST 1\n");
+        return;
+    }
+    char line[MAXLINELENGTH];
+    if (fgets(line, MAXLINELENGTH, digest->file) == NULL || strcmp(line, "LC2K-DIGEST 1\n")) {
+        printf("error: %s is not a golden digest\n", filename);
+        exit(1);
+    }
+}
+
+// report the first diverging cycle and stop. The digest holds only a hash for
+// every cycle after the latest anchor, so the expected block is shown only when
+// that cycle is itself an anchor; otherwise the report gives the hash mismatch
+// and the latest anchor. goldenHalt is the cycle the golden run halted at if it
+// ended before this one
+static void digestDiverged(digestType* digest, stateType* state, unsigned long long expected, int goldenHalt) {
+    unsigned int cycle = state->cycles;
+
+    digestCapture(digest, state);
+    printf("error: trace diverges from digest at cycle %u\n", cycle);
+    if (goldenHalt >= 0) {
+        printf("expected: machine halted after %d cycles\n", goldenHalt);
+    } else {
+        printf("expected hash %016llx, actual hash %016llx\n", expected,
+               digestHash(digest->text, digest->textLength));
+        if (digest->anchorOffset < 0) {
+            printf("expected: (no anchor in digest)\n");
+        } else {
+            char* anchor = malloc(digest->anchorLength + 1);
+            fseek(digest->file, digest->anchorOffset, SEEK_SET);
+            if (fread(anchor, 1, digest->anchorLength, digest->file) != digest->anchorLength) {
+                printf("expected: (digest truncated)\n");
+                exit(1);
+            }
+            anchor[digest->anchorLength] = '\0';
+            if (digest->anchorCycle == cycle) {
+                printf("expected:");
+            } else {
+                printf("expected: (not stored; the digest has only the hash for this cycle."
+                       " Last anchor, which matched, is at cycle %u)", digest->anchorCycle);
+            }
+            fputs(anchor, stdout);
+            free(anchor);
+        }
+    }
+    printf("actual:");
+    fwrite(digest->text, 1, digest->textLength, stdout);
+    exit(1);
+}
+
+// hash (and check or record) the printState block for the state before the current cycle
+void digestState(digestType* digest, stateType* state) {
+    int final = opcode(state->MEMWB.instr) == HALT;
+    digestCapture(digest, state);
+    unsigned long long hash = digestHash(digest->text, digest->textLength);
+    digest->cycles = state->cycles;
+
+    if (!digest->verify) {
+        if (state->cycles % DIGESTANCHORINTERVAL == 0 || final) {
+            fprintf(digest->file, "A %u %zu\n", state->cycles, digest->textLength);
+            fwrite(digest->text, 1, digest->textLength, digest->file);
+        }
+        fprintf(digest->file, "H %016llx\n", hash);
+        return;
+    }
+
+    char line[MAXLINELENGTH];
+    unsigned long long expected = 0;
+    unsigned int cycle;
+    size_t length;
+    while (fgets(line, MAXLINELENGTH, digest->file) != NULL) {
+        if (sscanf(line, "A %u %zu", &cycle, &length) == 2) {
+            digest->anchorCycle = cycle;
+            digest->anchorLength = length;
+            digest->anchorOffset = ftell(digest->file);
+            fseek(digest->file, (long)length, SEEK_CUR);
+        } else if (sscanf(line, "H %llx", &expected) == 1) {
+            break;
+        } else if (sscanf(line, "E %u", &cycle) == 1) {
+            digestDiverged(digest, state, 0, (int)cycle);
+        } else {
+            printf("error: malformed digest line: %s", line);
+            exit(1);
+        }
+    }
+    if (expected != hash) {
+        digestDiverged(digest, state, expected, -1);
+    }
+}
+
+void digestClose(digestType* digest) {
+    char line[MAXLINELENGTH];
+    unsigned int cycle;
+    if (!digest->verify) {
+        fprintf(digest->file, "E %u\n", digest->cycles);
+    } else if (fgets(line, MAXLINELENGTH, digest->file) == NULL || sscanf(line, "E %u", &cycle) != 1) {
+        printf("error: machine halted after %u cycles but the digest continues\n", digest->cycles);
+        exit(1);
+    } else {
+        printf("digest verified: %u cycles\n", cycle);
+    }
+    fclose(digest->file);
+    free(digest->text);
+    free(digest->format.prefixes);
+    free(digest->format.prefixEnd);
+}
+
 /*
- * DO NOT MODIFY ANY OF THE CODE BELOW.
- */
+ * Lockstep co-simulation.
+ * A one-instruction-at-a-time LC-2K model runs alongside the pipeline. When an
+ * instruction moves from MEMWB into WBEND its register write has happened and
+ * no younger instruction has written a register yet, so the reference executes
+ * the same instruction and the register files must agree. Stores reach memory
+ * two cycles before that, so the MEM stage queues them and they are checked
+ * against the reference when they retire. noop (and jalr, which the pipeline
+ * treats as one) has no architectural effect and is skipped by the reference,
+ * since it cannot be told apart from a squashed instruction.
+ **/
+
+void cosimInit(cosimType* cosim, stateType* state) {
+    cosim->pc = 0;
+    memset(cosim->reg, 0, sizeof(cosim->reg));
+    memcpy(cosim->mem, state->dataMem, sizeof(cosim->mem));
+    cosim->numPending = 0;
+    cosim->retired = 0;
+}
 
-void printInstruction(int instr) {
-    const char* instr_opcode_str;
-    int instr_opcode = opcode(instr);
-    if (ADD <= instr_opcode && instr_opcode <= NOOP) {
-        instr_opcode_str = opcode_to_str_map[instr_opcode];
+static void cosimMismatch(cosimType* cosim, stateType* newState, int instr, char* what) {
+    printf("error: co-simulation mismatch in cycle %u: %s\n", newState->cycles - 1, what);
+    printf("\tretiring instruction #%llu: ", cosim->retired);
+    printInstruction(instr);
+    printf("\n\treference pc = %d\n", cosim->pc);
+    for (int i = 0; i < NUMREGS; ++i) {
+        printf("\t\treference reg[ %d ] = %d\tpipeline reg[ %d ] = %d\n", i, cosim->reg[i], i, newState->reg[i]);
     }
+    printf("pipeline state after the cycle:");
+    printState(newState);
+    exit(1);
+}
 
-    switch (instr_opcode) {
+// execute reference instructions up to and including the next one with an effect; returns it
+static int cosimStep(cosimType* cosim, stateType* state) {
+    int instr;
+    do {
+        if (cosim->pc < 0 || cosim->pc >= NUMMEMORY) {
+            return NOOPINSTR;
+        }
+        instr = state->instrMem[cosim->pc++];
+    } while (opcode(instr) == NOOP || opcode(instr) == JALR);
+
+    int regA = cosim->reg[field0(instr)], regB = cosim->reg[field1(instr)];
+    int offset = convertNum(field2(instr));
+    switch (opcode(instr)) {
         case ADD:
+            cosim->reg[field2(instr)] = regA + regB;
+            break;
         case NOR:
+            cosim->reg[field2(instr)] = ~(regA | regB);
+            break;
         case LW:
+            cosim->reg[field1(instr)] = cosim->mem[regA + offset];
+            break;
         case SW:
-        case BEQ:
-            printf("%s %d %d %d", instr_opcode_str, field0(instr), field1(instr), convertNum(field2(instr)));
+            cosim->mem[regA + offset] = regB;
             break;
-        case JALR:
-            printf("%s %d %d", instr_opcode_str, field0(instr), field1(instr));
+        case BEQ:
+            if (regA == regB) {
+                cosim->pc += offset;
+            }
             break;
         case HALT:
-        case NOOP:
-            printf("%s", instr_opcode_str);
+            --cosim->pc;
             break;
-        default:
-            printf(".fill %d", instr);
-            return;
     }
+    return instr;
 }
 
-void printState(stateType* statePtr) {
-    printf("\n@@@\n");
-    printf("state before cycle %d starts:\n", statePtr->cycles);
-    printf("\tpc = %d\n", statePtr->pc);
+void cosimCycle(cosimType* cosim, stateType* state, stateType* newState, cycleInfoType* info) {
+    if (opcode(info->memInstr) == SW) {
+        if (cosim->numPending == COSIMPENDING) {
+            cosimMismatch(cosim, newState, info->memInstr, "stores are not retiring");
+        }
+        cosim->pendingAddr[cosim->numPending] = info->memAddr;
+        cosim->pendingData[cosim->numPending++] = info->memData;
+    }
+
+    int instr = state->MEMWB.instr;
+    if (opcode(instr) == NOOP || opcode(instr) == JALR) {
+        return;
+    }
+    int expected = cosimStep(cosim, state);
+    ++cosim->retired;
+    if (instr != expected) {
+        char what[MAXLINELENGTH];
+        sprintf(what, "reference expected instruction %d at pc %d", expected, cosim->pc - 1);
+        cosimMismatch(cosim, newState, instr, what);
+    }
+    if (opcode(instr) == SW) {
+        int addr = cosim->reg[field0(instr)] + convertNum(field2(instr));
+        if (cosim->numPending == 0 || cosim->pendingAddr[0] != addr ||
+            cosim->pendingData[0] != cosim->mem[addr]) {
+            char what[MAXLINELENGTH];
+            sprintf(what, "reference stored %d to dataMem[ %d ], pipeline stored %d to dataMem[ %d ]",
+                    cosim->mem[addr], addr, cosim->numPending ? cosim->pendingData[0] : 0,
+                    cosim->numPending ? cosim->pendingAddr[0] : -1);
+            cosimMismatch(cosim, newState, instr, what);
+        }
+        memmove(cosim->pendingAddr, cosim->pendingAddr + 1, sizeof(int) * (COSIMPENDING - 1));
+        memmove(cosim->pendingData, cosim->pendingData + 1, sizeof(int) * (COSIMPENDING - 1));
+        --cosim->numPending;
+    }
+    if (memcmp(cosim->reg, newState->reg, sizeof(cosim->reg))) {
+        cosimMismatch(cosim, newState, instr, "register files differ");
+    }
+}
 
-    printf("\tdata memory:\n");
-    for (int i = 0; i < statePtr->numMemory; ++i) {
-        printf("\t\tdataMem[ %d ] = %d\n", i, statePtr->dataMem[i]);
+// the halt in MEMWB must be the reference's next instruction and memory must agree
+void cosimHalt(cosimType* cosim, stateType* state) {
+    int instr = cosimStep(cosim, state);
+    if (opcode(instr) != HALT) {
+        cosimMismatch(cosim, state, state->MEMWB.instr, "pipeline halted before the reference");
     }
-    printf("\tregisters:\n");
+    for (int i = 0; i < NUMMEMORY; ++i) {
+        if (cosim->mem[i] != state->dataMem[i]) {
+            char what[MAXLINELENGTH];
+            sprintf(what, "at halt reference dataMem[ %d ] = %d, pipeline has %d", i, cosim->mem[i], state->dataMem[i]);
+            cosimMismatch(cosim, state, state->MEMWB.instr, what);
+        }
+    }
+    fprintf(stderr, "co-simulation: %llu instructions retired, no mismatch\n", cosim->retired);
+}
+
+/*
+ * VCD waveform export.
+ * Every signal is sampled at the start of each cycle (time = cycle number),
+ * together with the stall, squash and forwarding decisions made during that
+ * cycle. Only signals that changed are written, through one large buffer.
+ **/
+
+static const char* vcdScope[VCDSIGNALS] = {
+    "", "", "", "", "", "", "", "", "",
+    "IFID", "IFID",
+    "IDEX", "IDEX", "IDEX", "IDEX", "IDEX",
+    "EXMEM", "EXMEM", "EXMEM", "EXMEM", "EXMEM",
+    "MEMWB", "MEMWB",
+    "WBEND", "WBEND",
+    "", "", "", ""};
+static const char* vcdName[VCDSIGNALS] = {
+    "pc", "reg0", "reg1", "reg2", "reg3", "reg4", "reg5", "reg6", "reg7",
+    "instr", "pcPlus1",
+    "instr", "pcPlus1", "valA", "valB", "offset",
+    "instr", "branchTarget", "eq", "aluResult", "valB",
+    "instr", "writeData",
+    "instr", "writeData",
+    "stall", "squash", "forwardA", "forwardB"};
+static const int vcdWidth[VCDSIGNALS] = {
+    32, 32, 32, 32, 32, 32, 32, 32, 32,
+    32, 32,
+    32, 32, 32, 32, 32,
+    32, 32, 1, 32, 32,
+    32, 32,
+    32, 32,
+    1, 1, 2, 2};
+
+static void vcdValues(stateType* state, cycleInfoType* info, unsigned int values[VCDSIGNALS]) {
+    int n = 0;
+    values[n++] = state->pc;
     for (int i = 0; i < NUMREGS; ++i) {
-        printf("\t\treg[ %d ] = %d\n", i, statePtr->reg[i]);
-    }
-
-    // IF/ID
-    printf("\tIF/ID pipeline register:\n");
-    printf("\t\tinstruction = %d ( ", statePtr->IFID.instr);
-    printInstruction(statePtr->IFID.instr);
-    printf(" )\n");
-    printf("\t\tpcPlus1 = %d", statePtr->IFID.pcPlus1);
-    if (opcode(statePtr->IFID.instr) == NOOP) {
-        printf(" (Don't Care)");
-    }
-    printf("\n");
-
-    // ID/EX
-    int idexOp = opcode(statePtr->IDEX.instr);
-    printf("\tID/EX pipeline register:\n");
-    printf("\t\tinstruction = %d ( ", statePtr->IDEX.instr);
-    printInstruction(statePtr->IDEX.instr);
-    printf(" )\n");
-    printf("\t\tpcPlus1 = %d", statePtr->IDEX.pcPlus1);
-    if (idexOp == NOOP) {
-        printf(" (Don't Care)");
-    }
-    printf("\n");
-    printf("\t\treadRegA = %d", statePtr->IDEX.valA);
-    if (idexOp >= HALT || idexOp < 0) {
-        printf(" (Don't Care)");
-    }
-    printf("\n");
-    printf("\t\treadRegB = %d", statePtr->IDEX.valB);
-    if (idexOp == LW || idexOp > BEQ || idexOp < 0) {
-        printf(" (Don't Care)");
-    }
-    printf("\n");
-    printf("\t\toffset = %d", statePtr->IDEX.offset);
-    if (idexOp != LW && idexOp != SW && idexOp != BEQ) {
-        printf(" (Don't Care)");
-    }
-    printf("\n");
-
-    // EX/MEM
-    int exmemOp = opcode(statePtr->EXMEM.instr);
-    printf("\tEX/MEM pipeline register:\n");
-    printf("\t\tinstruction = %d ( ", statePtr->EXMEM.instr);
-    printInstruction(statePtr->EXMEM.instr);
-    printf(" )\n");
-    printf("\t\tbranchTarget %d", statePtr->EXMEM.branchTarget);
-    if (exmemOp != BEQ) {
-        printf(" (Don't Care)");
-    }
-    printf("\n");
-    printf("\t\teq ? %s", (statePtr->EXMEM.eq ? "True" : "False"));
-    if (exmemOp != BEQ) {
-        printf(" (Don't Care)");
-    }
-    printf("\n");
-    printf("\t\taluResult = %d", statePtr->EXMEM.aluResult);
-    if (exmemOp > SW || exmemOp < 0) {
-        printf(" (Don't Care)");
-    }
-    printf("\n");
-    printf("\t\treadRegB = %d", statePtr->EXMEM.valB);
-    if (exmemOp != SW) {
-        printf(" (Don't Care)");
-    }
-    printf("\n");
-
-    // MEM/WB
-    int memwbOp = opcode(statePtr->MEMWB.instr);
-    printf("\tMEM/WB pipeline register:\n");
-    printf("\t\tinstruction = %d ( ", statePtr->MEMWB.instr);
-    printInstruction(statePtr->MEMWB.instr);
-    printf(" )\n");
-    printf("\t\twriteData = %d", statePtr->MEMWB.writeData);
-    if (memwbOp >= SW || memwbOp < 0) {
-        printf(" (Don't Care)");
-    }
-    printf("\n");
-
-    // WB/END
-    int wbendOp = opcode(statePtr->WBEND.instr);
-    printf("\tWB/END pipeline register:\n");
-    printf("\t\tinstruction = %d ( ", statePtr->WBEND.instr);
-    printInstruction(statePtr->WBEND.instr);
-    printf(" )\n");
-    printf("\t\twriteData = %d", statePtr->WBEND.writeData);
-    if (wbendOp >= SW || wbendOp < 0) {
-        printf(" (Don't Care)");
-    }
-    printf("\n");
-
-    printf("end state\n");
-    fflush(stdout);
+        values[n++] = state->reg[i];
+    }
+    values[n++] = state->IFID.instr;
+    values[n++] = state->IFID.pcPlus1;
+    values[n++] = state->IDEX.instr;
+    values[n++] = state->IDEX.pcPlus1;
+    values[n++] = state->IDEX.valA;
+    values[n++] = state->IDEX.valB;
+    values[n++] = state->IDEX.offset;
+    values[n++] = state->EXMEM.instr;
+    values[n++] = state->EXMEM.branchTarget;
+    values[n++] = state->EXMEM.eq != 0;
+    values[n++] = state->EXMEM.aluResult;
+    values[n++] = state->EXMEM.valB;
+    values[n++] = state->MEMWB.instr;
+    values[n++] = state->MEMWB.writeData;
+    values[n++] = state->WBEND.instr;
+    values[n++] = state->WBEND.writeData;
+    values[n++] = info->stall != 0;
+    values[n++] = info->branchTaken != 0;
+    values[n++] = info->forward[0];
+    values[n++] = info->forward[1];
 }
 
-// File
-#define MAXLINELENGTH 1000  // MAXLINELENGTH is the max number of characters we read
+static void vcdFlush(vcdType* vcd) {
+    fwrite(vcd->buffer, 1, vcd->length, vcd->file);
+    vcd->length = 0;
+}
 
-void readMachineCode(stateType* state, char* filename) {
-    char line[MAXLINELENGTH];
-    FILE* filePtr = fopen(filename, "r");
-    if (filePtr == NULL) {
-        printf("error: can't open file %s", filename);
+// append one value change, e.g. "b101 #" or "1!"
+static void vcdChange(vcdType* vcd, int signal, unsigned int value) {
+    char* out = vcd->buffer + vcd->length;
+    if (vcdWidth[signal] == 1) {
+        *out++ = '0' + (value & 1);
+    } else {
+        // leading zeros may be dropped; a leading one may not, since it would be zero-extended
+        int bit = vcdWidth[signal] - 1;
+        while (bit > 0 && !((value >> bit) & 1)) {
+            --bit;
+        }
+        *out++ = 'b';
+        for (; bit >= 0; --bit) {
+            *out++ = '0' + ((value >> bit) & 1);
+        }
+        *out++ = ' ';
+    }
+    *out++ = '!' + signal;
+    *out++ = '\n';
+    vcd->length = out - vcd->buffer;
+}
+
+void vcdOpen(vcdType* vcd, char* filename) {
+    vcd->file = fopen(filename, "w");
+    if (vcd->file == NULL) {
+        printf("error: can't open file %s\n", filename);
         exit(1);
     }
+    fprintf(vcd->file, "$timescale 1ns $end\n$scope module lc2k $end\n");
+    const char* scope = "";
+    for (int i = 0; i < VCDSIGNALS; ++i) {
+        if (strcmp(scope, vcdScope[i])) {
+            if (*scope) {
+                fprintf(vcd->file, "$upscope $end\n");
+            }
+            scope = vcdScope[i];
+            if (*scope) {
+                fprintf(vcd->file, "$scope module %s $end\n", scope);
+            }
+        }
+        fprintf(vcd->file, "$var wire %d %c %s $end\n", vcdWidth[i], '!' + i, vcdName[i]);
+    }
+    if (*scope) {
+        fprintf(vcd->file, "$upscope $end\n");
+    }
+    fprintf(vcd->file, "$upscope $end\n$enddefinitions $end\n");
+    vcd->length = 0;
+    vcd->started = 0;
+}
 
-    printf("instruction memory:\n");
-    for (state->numMemory = 0; fgets(line, MAXLINELENGTH, filePtr) != NULL; ++state->numMemory) {
-        if (sscanf(line, "%d", state->instrMem + state->numMemory) != 1) {
-            printf("error in reading address %d\n", state->numMemory);
+void vcdState(vcdType* vcd, stateType* state, cycleInfoType* info) {
+    unsigned int values[VCDSIGNALS];
+    vcdValues(state, info, values);
+    if (vcd->length > VCDBUFFER - (VCDSIGNALS + 1) * 40) {
+        vcdFlush(vcd);
+    }
+    vcd->length += sprintf(vcd->buffer + vcd->length, "#%u\n", state->cycles);
+    if (!vcd->started) {
+        vcd->length += sprintf(vcd->buffer + vcd->length, "$dumpvars\n");
+    }
+    for (int i = 0; i < VCDSIGNALS; ++i) {
+        if (!vcd->started || values[i] != vcd->last[i]) {
+            vcdChange(vcd, i, values[i]);
+            vcd->last[i] = values[i];
+        }
+    }
+    if (!vcd->started) {
+        vcd->length += sprintf(vcd->buffer + vcd->length, "$end\n");
+        vcd->started = 1;
+    }
+}
+
+void vcdClose(vcdType* vcd) {
+    vcdFlush(vcd);
+    fclose(vcd->file);
+}
+
+/*
+ * Pipe trace tables, as in the project spec: one row per fetched instruction,
+ * one column per cycle, showing the stage it occupies. "*" marks a cycle lost
+ * to the load-use stall and "x" the cycle in which a taken branch discarded
+ * it. Each row only keeps the few cycles its instruction spends in flight, so
+ * memory does not grow with the window or the program.
+ **/
+
+static const char* pipeStageName[] = {"", "IF", "ID", "EX", "MEM", "WB"};
+
+static void pipeTraceCell(pipeTraceType* trace, long long tag, unsigned int cycle, int cell) {
+    if (tag < 0) {
+        return;
+    }
+    pipeRowType* row = &trace->rows[tag % PIPEROWS];
+    if (cycle - row->firstCycle < PIPEROWCELLS) {
+        row->cells[cycle - row->firstCycle] = cell;
+        row->numCells = cycle - row->firstCycle + 1;
+    }
+}
+
+static void pipeTraceDone(pipeTraceType* trace, long long tag) {
+    if (tag >= 0) {
+        trace->rows[tag % PIPEROWS].done = 1;
+    }
+}
+
+// print every finished row whose older rows have all been printed
+static void pipeTracePrint(pipeTraceType* trace) {
+    for (; trace->numPrinted < trace->numRows; ++trace->numPrinted) {
+        pipeRowType* row = &trace->rows[trace->numPrinted % PIPEROWS];
+        if (!row->done) {
+            return;
+        }
+        if (row->firstCycle + row->numCells <= trace->first || row->firstCycle >= trace->last) {
+            continue;
+        }
+        char text[MAXLINELENGTH];
+        instructionText(row->instr, text);
+        if (trace->csv) {
+            fprintf(trace->file, "%d,%s", row->pc, text);
+        } else {
+            int pad = 20 - (int)strlen(text);
+            fprintf(trace->file, "| `%s`%*s |", text, pad > 0 ? pad : 0, "");
+        }
+        for (unsigned int cycle = trace->first; cycle < trace->last; ++cycle) {
+            char cell[8] = "";
+            unsigned int offset = cycle - row->firstCycle;
+            if (cycle >= row->firstCycle && offset < (unsigned int)row->numCells && row->cells[offset]) {
+                sprintf(cell, "%s%s%s", pipeStageName[row->cells[offset] & 0xf],
+                        row->cells[offset] & PIPESTALL ? "*" : "",
+                        row->cells[offset] & PIPESQUASH ? "x" : "");
+            }
+            if (trace->csv) {
+                fprintf(trace->file, ",%s", cell);
+            } else {
+                fprintf(trace->file, " %-8s |", cell);
+            }
+        }
+        fprintf(trace->file, "\n");
+    }
+}
+
+void pipeTraceOpen(pipeTraceType* trace, char* filename, unsigned int first, unsigned int last) {
+    size_t length = strlen(filename);
+    trace->file = fopen(filename, "w");
+    if (trace->file == NULL) {
+        printf("error: can't open file %s\n", filename);
+        exit(1);
+    }
+    trace->csv = length > 4 && !strcmp(filename + length - 4, ".csv");
+    trace->first = first;
+    trace->last = last;
+    trace->fetch = -1;
+    for (int i = 0; i < 4; ++i) {
+        trace->tags[i] = -1;
+    }
+    trace->numRows = trace->numPrinted = 0;
+
+    if (trace->csv) {
+        fprintf(trace->file, "pc,instruction");
+        for (unsigned int cycle = first; cycle < last; ++cycle) {
+            fprintf(trace->file, ",%u", cycle);
+        }
+        fprintf(trace->file, "\n");
+        return;
+    }
+    fprintf(trace->file, "| %-22s |", "Pipe Trace");
+    for (unsigned int cycle = first; cycle < last; ++cycle) {
+        char header[32];
+        sprintf(header, "Cycle %u", cycle);
+        fprintf(trace->file, " %-8s |", header);
+    }
+    fprintf(trace->file, "\n| ---------------------- |");
+    for (unsigned int cycle = first; cycle < last; ++cycle) {
+        fprintf(trace->file, " -------- |");
+    }
+    fprintf(trace->file, "\n");
+}
+
+// record where every instruction is during the cycle starting in state
+void pipeTraceCycle(pipeTraceType* trace, stateType* state, cycleInfoType* info) {
+    unsigned int cycle = state->cycles;
+    if (trace->fetch < 0) {
+        trace->fetch = trace->numRows++;
+        pipeRowType* row = &trace->rows[trace->fetch % PIPEROWS];
+        row->pc = state->pc;
+        row->instr = state->instrMem[state->pc];
+        row->done = 0;
+        row->firstCycle = cycle;
+        row->numCells = 0;
+    }
+    int stall = info->stall ? PIPESTALL : 0;
+    int squash = info->branchTaken ? PIPESQUASH : 0;
+    pipeTraceCell(trace, trace->fetch, cycle, 1 | stall | squash);
+    pipeTraceCell(trace, trace->tags[0], cycle, 2 | stall | squash);
+    pipeTraceCell(trace, trace->tags[1], cycle, 3 | squash);
+    pipeTraceCell(trace, trace->tags[2], cycle, 4);
+    pipeTraceCell(trace, trace->tags[3], cycle, 5);
+
+    pipeTraceDone(trace, trace->tags[3]);
+    trace->tags[3] = trace->tags[2];
+    if (squash) {
+        pipeTraceDone(trace, trace->fetch);
+        pipeTraceDone(trace, trace->tags[0]);
+        pipeTraceDone(trace, trace->tags[1]);
+        trace->fetch = trace->tags[0] = trace->tags[1] = trace->tags[2] = -1;
+    } else if (stall) {
+        trace->tags[2] = trace->tags[1];
+        trace->tags[1] = -1;
+    } else {
+        trace->tags[2] = trace->tags[1];
+        trace->tags[1] = trace->tags[0];
+        trace->tags[0] = trace->fetch;
+        trace->fetch = -1;
+    }
+    pipeTracePrint(trace);
+}
+
+void pipeTraceClose(pipeTraceType* trace) {
+    pipeTraceDone(trace, trace->fetch);
+    for (int i = 0; i < 4; ++i) {
+        pipeTraceDone(trace, trace->tags[i]);
+    }
+    pipeTracePrint(trace);
+    fclose(trace->file);
+}
+
+/*
+ * Branch profiles.
+ * Counts how often each beq resolves taken and not taken in MEM. The file
+ * has one "pc taken notTaken" line per beq that was executed, in pc order.
+ **/
+
+void profileCycle(branchProfileType* profile, stateType* state, cycleInfoType* info) {
+    if (opcode(info->memInstr) != BEQ) {
+        return;
+    }
+    // squashed instructions are noops, so this beq really executed; recover its pc from the target
+    int pc = state->EXMEM.branchTarget - 1 - convertNum(field2(info->memInstr));
+    if (info->branchTaken) {
+        ++profile->taken[pc];
+    } else {
+        ++profile->notTaken[pc];
+    }
+}
+
+void profileWrite(branchProfileType* profile, char* filename) {
+    FILE* file = fopen(filename, "w");
+    if (file == NULL) {
+        printf("error: can't open file %s\n", filename);
+        exit(1);
+    }
+    for (int pc = 0; pc < NUMMEMORY; ++pc) {
+        if (profile->taken[pc] || profile->notTaken[pc]) {
+            fprintf(file, "%d %llu %llu\n", pc, profile->taken[pc], profile->notTaken[pc]);
+        }
+    }
+    fclose(file);
+}
+
+/*
+ * Breakpoints and watchpoints.
+ * The pipeline tests one bit per fetched pc and per lw/sw address, and
+ * only when a map is set, so a run without -b or -d costs nothing extra.
+ **/
+
+// set the bit of each address in a comma-separated list
+void parseAddresses(char* list, unsigned int* map) {
+    char* end = list;
+    do {
+        long addr = strtol(end + (end != list), &end, 10);
+        if (addr < 0 || addr >= NUMMEMORY || (*end != ',' && *end != '\0')) {
+            printf("error: bad address list %s\n", list);
             exit(1);
         }
-        printf("\tinstrMem[ %d ]\t= 0x%08x\t= %d\t= ", state->numMemory,
-               state->instrMem[state->numMemory], state->instrMem[state->numMemory]);
-        printInstruction(state->dataMem[state->numMemory] = state->instrMem[state->numMemory]);
-        printf("\n");
+        map[addr >> 5] |= 1u << (addr & 31);
+    } while (*end == ',');
+}
+
+// report what fired in the cycle that starts from state
+void debugHit(stateType* state, cycleInfoType* info, int silent) {
+    if (info->hit & HITBREAKPOINT) {
+        printf("breakpoint: pc %d fetched in cycle %u\n", state->pc, state->cycles);
+    }
+    if (info->hit & HITWATCHPOINT) {
+        printf("watchpoint: %s dataMem[ %d ] = %d in cycle %u\n", opcode(info->memInstr) == LW ? "lw" : "sw",
+               info->memAddr, info->memData, state->cycles);
+    }
+    if (silent) {
+        printState(state);
     }
 }
 
-int getRegValue(stateType* state, int reg, int now) {
-    if (opcode(state->EXMEM.instr) <= NOR &&
-        field2(state->EXMEM.instr) == reg) {
-        return state->EXMEM.aluResult;
+/*
+ * Threaded trace formatting.
+ * The simulation loop only copies each printed state into a compact record
+ * (registers, pipeline registers and the one memory word the cycle before
+ * may have stored); records of consecutive cycles are grouped in batches
+ * that start with a copy of data memory. Batches go round a ring with one
+ * producer, and batch n is formatted by thread n % numThreads, which waits
+ * for batch n - 1 to be written before writing its own, so the trace comes
+ * out in cycle order. The counters are the only shared state and are
+ * touched with atomic loads and stores; nobody takes a lock.
+ **/
+
+static traceThreadsType* traceActive;  // finished at exit, so an error still gets the trace before it
+
+static unsigned long long traceLoad(unsigned long long* counter) {
+    return __atomic_load_n(counter, __ATOMIC_ACQUIRE);
+}
+
+static void* traceWorker(void* arg) {
+    traceWorkerType* worker = arg;
+    traceThreadsType* threads = worker->threads;
+    stateType* state = calloc(1, sizeof(stateType));
+    fastFormatType* format = calloc(1, sizeof(fastFormatType));
+    char* text = malloc((size_t)threads->batchSize * fastStateSize(threads->numMemory));
+    state->numMemory = (unsigned int)threads->numMemory;
+
+    for (unsigned long long n = (unsigned long long)worker->index;; n += (unsigned long long)threads->numThreads) {
+        while (traceLoad(&threads->produced) <= n) {
+            if (__atomic_load_n(&threads->done, __ATOMIC_ACQUIRE) && traceLoad(&threads->produced) <= n) {
+                free(text);
+                free(format->prefixes);
+                free(format->prefixEnd);
+                free(format);
+                free(state);
+                return NULL;
+            }
+            sched_yield();
+        }
+
+        traceBatchType* batch = threads->ring + n % TRACERING;
+        memcpy(state->dataMem, batch->memory, (size_t)threads->numMemory * sizeof(int));
+        char* end = text;
+        for (int i = 0; i < batch->numRecords; ++i) {
+            traceRecordType* record = batch->records + i;
+            if (i > 0 && record->writeAddr >= 0) {
+                state->dataMem[record->writeAddr] = record->writeData;
+            }
+            state->cycles = record->cycles;
+            state->pc = record->pc;
+            memcpy(state->reg, record->reg, sizeof(state->reg));
+            state->IFID = record->IFID;
+            state->IDEX = record->IDEX;
+            state->EXMEM = record->EXMEM;
+            state->MEMWB = record->MEMWB;
+            state->WBEND = record->WBEND;
+            end = fastFormatState(format, end, state);
+        }
+
+        while (traceLoad(&threads->written) != n) {
+            sched_yield();
+        }
+        fastWrite(text, (size_t)(end - text));
+        __atomic_store_n(&threads->written, n + 1, __ATOMIC_RELEASE);
     }
-    if (opcode(state->MEMWB.instr) <= NOR &&
-        field2(state->MEMWB.instr) == reg) {
-        return state->MEMWB.writeData;
+}
+
+static void traceThreadsExit(void) {
+    if (traceActive) {
+        traceThreadsFinish(traceActive);
     }
-    if (opcode(state->MEMWB.instr) == LW &&
-        field1(state->MEMWB.instr) == reg) {
-        return state->MEMWB.writeData;
+}
+
+void traceThreadsStart(traceThreadsType* threads, int numThreads, int numMemory) {
+    threads->numThreads = numThreads;
+    threads->numMemory = numMemory;
+    threads->batchSize = (int)(TRACEBATCHBYTES / fastStateSize(numMemory));
+    if (threads->batchSize < 1) {
+        threads->batchSize = 1;
+    } else if (threads->batchSize > TRACEBATCHMAX) {
+        threads->batchSize = TRACEBATCHMAX;
     }
-    if (opcode(state->WBEND.instr) <= NOR &&
-        field2(state->WBEND.instr) == reg) {
-        return state->WBEND.writeData;
+    for (int i = 0; i < TRACERING; ++i) {
+        threads->ring[i].numRecords = 0;
+        threads->ring[i].memory = malloc(((size_t)numMemory + 1) * sizeof(int));
+        threads->ring[i].records = malloc((size_t)threads->batchSize * sizeof(traceRecordType));
     }
-    if (opcode(state->WBEND.instr) == LW &&
-        field1(state->WBEND.instr) == reg) {
-        return state->WBEND.writeData;
+    threads->produced = threads->written = 0;
+    threads->done = 0;
+    threads->writeAddr = -1;
+
+    // the trace bypasses stdio from here on
+    fflush(stdout);
+    for (int i = 0; i < numThreads; ++i) {
+        threads->workers[i].threads = threads;
+        threads->workers[i].index = i;
+        if (pthread_create(&threads->workers[i].thread, NULL, traceWorker, threads->workers + i)) {
+            printf("error: can't start trace thread\n");
+            exit(1);
+        }
     }
+    traceActive = threads;
+    atexit(traceThreadsExit);
+}
 
-    return now;
+// hand the current batch to its formatter and wait for the next ring slot to be written out
+static void tracePublish(traceThreadsType* threads) {
+    if (threads->ring[threads->produced % TRACERING].numRecords == 0) {
+        return;
+    }
+    __atomic_store_n(&threads->produced, threads->produced + 1, __ATOMIC_RELEASE);
+    while (threads->produced - traceLoad(&threads->written) >= TRACERING) {
+        sched_yield();
+    }
+    threads->ring[threads->produced % TRACERING].numRecords = 0;
 }
 
-int isRegUsed(int instr, int reg) {
-    int opc = opcode(instr);
-    // printf("===========================%d %d %d\n", field0(instr), field1(instr), reg);
-    switch (opc) {
-        case ADD:
-        case NOR:
-        case BEQ:
-        case SW:
-            // case LW:
-            return field0(instr) == reg || field1(instr) == reg;
-        case LW:
-            return field0(instr) == reg;
-        default:
-            break;
+// queue the printState block of state
+void traceThreadsState(traceThreadsType* threads, stateType* state) {
+    traceBatchType* batch = threads->ring + threads->produced % TRACERING;
+    if (batch->numRecords > 0 &&
+        (batch->numRecords == threads->batchSize || state->cycles != threads->lastCycle + 1)) {
+        tracePublish(threads);
+        batch = threads->ring + threads->produced % TRACERING;
     }
-    return 0;
+    if (batch->numRecords == 0) {
+        memcpy(batch->memory, state->dataMem, (size_t)threads->numMemory * sizeof(int));
+    }
+    traceRecordType* record = batch->records + batch->numRecords++;
+    record->cycles = state->cycles;
+    record->pc = state->pc;
+    memcpy(record->reg, state->reg, sizeof(record->reg));
+    record->IFID = state->IFID;
+    record->IDEX = state->IDEX;
+    record->EXMEM = state->EXMEM;
+    record->MEMWB = state->MEMWB;
+    record->WBEND = state->WBEND;
+    record->writeAddr = threads->writeAddr;
+    record->writeData = threads->writeData;
+    threads->lastCycle = state->cycles;
+}
+
+// remember the memory word this cycle stored, for the next record
+void traceThreadsCycle(traceThreadsType* threads, cycleInfoType* info) {
+    threads->writeAddr = opcode(info->memInstr) == SW ? info->memAddr : -1;
+    threads->writeData = info->memData;
+}
+
+// write out every queued block, so stdout can be used directly
+void traceThreadsDrain(traceThreadsType* threads) {
+    tracePublish(threads);
+    while (traceLoad(&threads->written) != threads->produced) {
+        sched_yield();
+    }
+}
+
+void traceThreadsFinish(traceThreadsType* threads) {
+    if (threads->numThreads == 0) {
+        return;
+    }
+    tracePublish(threads);
+    __atomic_store_n(&threads->done, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < threads->numThreads; ++i) {
+        pthread_join(threads->workers[i].thread, NULL);
+    }
+    threads->numThreads = 0;
+    for (int i = 0; i < TRACERING; ++i) {
+        free(threads->ring[i].memory);
+        free(threads->ring[i].records);
+    }
+}
+
+/*
+ * Binary traces.
+ * The writer lives in bintrace.c; an error exit part way through a run
+ * still closes the file, so the cycles before the error can be viewed.
+ **/
+
+static binTraceType* binTraceActive;
+
+static void binTraceExit(void) {
+    binTraceClose(binTraceActive);
+}
+
+void binTraceAtExit(binTraceType* trace) {
+    binTraceActive = trace;
+    atexit(binTraceExit);
+}
+
+/*
+ * Hazard coverage.
+ * Counts the forwarding paths, load-use stalls and branch outcomes a run
+ * exercises. The file has one "count event" line for every event, zero or
+ * not, so mincover can tell what a set of tests leaves uncovered.
+ **/
+
+static const char* coverageName[COVEREVENTS] = {
+    "forward regA from EXMEM", "forward regA from MEMWB", "forward regA from WBEND",
+    "forward regB from EXMEM", "forward regB from MEMWB", "forward regB from WBEND",
+    "forward sw data from EXMEM", "forward sw data from MEMWB", "forward sw data from WBEND",
+    "load-use stall before add", "load-use stall before nor", "load-use stall before lw",
+    "load-use stall before sw", "load-use stall before beq",
+    "beq not taken",
+    "beq taken, squashing bubbles only", "beq taken, squashing IF", "beq taken, squashing ID",
+    "beq taken, squashing IF+ID", "beq taken, squashing EX", "beq taken, squashing IF+EX",
+    "beq taken, squashing ID+EX", "beq taken, squashing IF+ID+EX"};
+
+void coverageCycle(coverageType* coverage, stateType* state, cycleInfoType* info) {
+    int exOp = opcode(info->exInstr);
+    if (exOp <= BEQ && info->forward[0] != FORWARDNONE) {
+        ++coverage->count[COVERFORWARDA + info->forward[0] - 1];
+    }
+    if ((exOp <= NOR || exOp == BEQ || exOp == SW) && info->forward[1] != FORWARDNONE) {
+        ++coverage->count[(exOp == SW ? COVERFORWARDSW : COVERFORWARDB) + info->forward[1] - 1];
+    }
+    if (info->stall) {
+        ++coverage->count[COVERSTALL + opcode(state->IFID.instr)];
+    }
+    if (opcode(info->memInstr) == BEQ) {
+        if (!info->branchTaken) {
+            ++coverage->count[COVERNOTTAKEN];
+        } else {
+            // a noop squashed is no different from a bubble
+            int squashed = (opcode(state->instrMem[state->pc]) != NOOP) | (opcode(state->IFID.instr) != NOOP) << 1 |
+                           (opcode(state->IDEX.instr) != NOOP) << 2;
+            ++coverage->count[COVERTAKEN + squashed];
+        }
+    }
+}
+
+void coverageWrite(coverageType* coverage, char* filename) {
+    FILE* file = fopen(filename, "w");
+    if (file == NULL) {
+        printf("error: can't open file %s\n", filename);
+        exit(1);
+    }
+    for (int i = 0; i < COVEREVENTS; ++i) {
+        fprintf(file, "%llu %s\n", coverage->count[i], coverageName[i]);
+    }
+    fclose(file);
 }
@@ -0,0 +1,348 @@
+/*
+ * Design-space sweep of pipeline variations over a set of programs.
+ * Takes a list of values for every parameter of pipelineConfigType (where
+ * beq resolves, BTB entries, data cache size, ways and block size, miss
+ * penalty) and simulates every program on every combination, in-process
+ * on worker threads, each with its own pipelineModelType. For every
+ * configuration it reports the total cycles over the programs, the CPI and
+ * the cycles lost to load-use stalls, to instructions squashed behind
+ * mispredicted beqs and to waiting on data cache misses (a stall can fall
+ * in the shadow of a squash, so they overlap a little). A configuration
+ * is Pareto-best if no other one needs both fewer cycles and less storage
+ * (BTB entries count two words, a cache its data words plus one tag per
+ * block); resolving beq in EX is taken to be free. Every run is checked
+ * against a functional simulation of the program.
+ **/
+
+#define _POSIX_C_SOURCE 200809L  // sysconf
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pipeline.h"
+#include "program.h"
+
+#define MAXTHREADS 64
+#define MAXPROGRAMS 256
+#define MAXVALUES 16  // values of one parameter
+
+typedef struct benchmarkStruct {
+    char* name;
+    programType program;
+    unsigned long long instructions;  // executed, halt included
+    int reg[NUMREGS];                 // what the program should end with
+    int* mem;
+} benchmarkType;
+
+typedef struct runStruct {
+    unsigned long long cycles, stalls, mispredicts, accesses, misses, waitCycles;
+} runType;
+
+typedef struct pointStruct {
+    pipelineConfigType config;
+    runType total;
+    unsigned long long instructions;
+    long long cost;                   // words of storage
+    int pareto;
+} pointType;
+
+typedef struct sweepStruct {
+    benchmarkType* benchmarks;
+    int numBenchmarks;
+    pointType* points;
+    int numPoints;
+    runType* runs;                    // point * numBenchmarks + benchmark
+    unsigned int maxCycles;
+    int next;                         // next run to hand out, taken with an atomic add
+} sweepType;
+
+int parseList(char*, int*, int);
+unsigned long long functionalRun(programType*, char*, unsigned int, int*, int*);
+void* worker(void*);
+void simulateRun(sweepType*, int, int, stateType**);
+void printConfig(FILE*, pipelineConfigType*, char);
+
+int main(int argc, char* argv[]) {
+    static benchmarkType benchmarks[MAXPROGRAMS];
+    static sweepType sweep;
+    int numThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);  // -j <threads>
+    char* csvFile = NULL;                                 // -o <file>: also write the table as CSV
+    sweep.maxCycles = 100000000;                          // -m <cycles>: per program
+    // the grid: -r mem,ex -b btbEntries,... -c cacheWords,... -a ways,... -l blockWords,... -p missPenalty,...
+    int resolve[MAXVALUES] = {0, 1}, btb[MAXVALUES] = {0, 16}, cache[MAXVALUES] = {0, 64, 256};
+    int ways[MAXVALUES] = {1, 4}, block[MAXVALUES] = {4}, penalty[MAXVALUES] = {10};
+    int numResolve = 2, numBtb = 2, numCache = 3, numWays = 2, numBlock = 1, numPenalty = 1;
+
+    int argi = 1;
+    for (; argi < argc - 1 && argv[argi][0] == '-'; ++argi) {
+        if (!strcmp(argv[argi], "-j") && argi + 1 < argc - 1) {
+            numThreads = atoi(argv[++argi]);
+        } else if (!strcmp(argv[argi], "-m") && argi + 1 < argc - 1) {
+            sweep.maxCycles = strtoul(argv[++argi], NULL, 10);
+        } else if (!strcmp(argv[argi], "-o") && argi + 1 < argc - 1) {
+            csvFile = argv[++argi];
+        } else if (!strcmp(argv[argi], "-r") && argi + 1 < argc - 1) {
+            numResolve = 0;
+            for (char* name = strtok(argv[++argi], ","); name; name = strtok(NULL, ",")) {
+                if ((strcmp(name, "mem") && strcmp(name, "ex")) || numResolve == MAXVALUES) {
+                    printf("error: beq resolves in mem or ex, not %s\n", name);
+                    exit(1);
+                }
+                resolve[numResolve++] = !strcmp(name, "ex");
+            }
+        } else if (!strcmp(argv[argi], "-b") && argi + 1 < argc - 1) {
+            numBtb = parseList(argv[++argi], btb, 0);
+        } else if (!strcmp(argv[argi], "-c") && argi + 1 < argc - 1) {
+            numCache = parseList(argv[++argi], cache, 0);
+        } else if (!strcmp(argv[argi], "-a") && argi + 1 < argc - 1) {
+            numWays = parseList(argv[++argi], ways, 1);
+        } else if (!strcmp(argv[argi], "-l") && argi + 1 < argc - 1) {
+            numBlock = parseList(argv[++argi], block, 1);
+        } else if (!strcmp(argv[argi], "-p") && argi + 1 < argc - 1) {
+            numPenalty = parseList(argv[++argi], penalty, 0);
+        } else {
+            break;
+        }
+    }
+    if (argi >= argc || argv[argi][0] == '-' || numThreads < 1 || argc - argi > MAXPROGRAMS || !numResolve) {
+        printf("error: usage: %s [-j threads] [-m maxCycles] [-o csv] [-r mem,ex] [-b btbEntries,...] [-c cacheWords,...] [-a ways,...] [-l blockWords,...] [-p missPenalty,...] <machine-code file> ...\n",
+               argv[0]);
+        exit(1);
+    }
+    if (numThreads > MAXTHREADS) {
+        numThreads = MAXTHREADS;
+    }
+
+    for (; argi < argc; ++argi) {
+        benchmarkType* benchmark = &benchmarks[sweep.numBenchmarks++];
+        benchmark->name = argv[argi];
+        readProgram(&benchmark->program, argv[argi]);
+        benchmark->mem = calloc(NUMMEMORY, sizeof(int));
+        benchmark->instructions = functionalRun(&benchmark->program, argv[argi], sweep.maxCycles, benchmark->reg,
+                                                benchmark->mem);
+    }
+    sweep.benchmarks = benchmarks;
+
+    // every combination, without repeating the no-cache point for each cache shape
+    sweep.points = malloc((size_t)numResolve * numBtb * numCache * numWays * numBlock * numPenalty * sizeof(pointType));
+    for (int r = 0; r < numResolve; ++r)
+        for (int b = 0; b < numBtb; ++b)
+            for (int c = 0; c < numCache; ++c)
+                for (int a = 0; a < numWays; ++a)
+                    for (int l = 0; l < numBlock; ++l)
+                        for (int p = 0; p < numPenalty; ++p) {
+                            if (cache[c] ? cache[c] % (ways[a] * block[l]) != 0 : a || l) {
+                                continue;
+                            }
+                            pointType* point = &sweep.points[sweep.numPoints++];
+                            memset(point, 0, sizeof(*point));
+                            pipelineConfigType config = {resolve[r], btb[b], cache[c], cache[c] ? ways[a] : 0,
+                                                         cache[c] ? block[l] : 0, penalty[p]};
+                            point->config = config;
+                            point->cost = 2LL * btb[b] + (cache[c] ? cache[c] + cache[c] / block[l] : 0);
+                        }
+    if (!sweep.numPoints) {
+        printf("error: no cache size is a multiple of its ways times its block size\n");
+        exit(1);
+    }
+
+    sweep.runs = calloc((size_t)sweep.numPoints * sweep.numBenchmarks, sizeof(runType));
+    pthread_t threads[MAXTHREADS];
+    if (numThreads > sweep.numPoints * sweep.numBenchmarks) {
+        numThreads = sweep.numPoints * sweep.numBenchmarks;
+    }
+    for (int i = 0; i < numThreads; ++i) {
+        if (pthread_create(threads + i, NULL, worker, &sweep)) {
+            printf("error: can't start worker thread\n");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < numThreads; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i = 0; i < sweep.numPoints; ++i) {
+        pointType* point = &sweep.points[i];
+        for (int k = 0; k < sweep.numBenchmarks; ++k) {
+            runType* run = &sweep.runs[i * sweep.numBenchmarks + k];
+            point->total.cycles += run->cycles;
+            point->total.stalls += run->stalls;
+            point->total.mispredicts += run->mispredicts;
+            point->total.accesses += run->accesses;
+            point->total.misses += run->misses;
+            point->total.waitCycles += run->waitCycles;
+            point->instructions += sweep.benchmarks[k].instructions;
+        }
+    }
+    int numPareto = 0;
+    for (int i = 0; i < sweep.numPoints; ++i) {
+        pointType* point = &sweep.points[i];
+        point->pareto = 1;
+        for (int j = 0; j < sweep.numPoints && point->pareto; ++j) {
+            pointType* other = &sweep.points[j];
+            if (other->total.cycles <= point->total.cycles && other->cost <= point->cost &&
+                (other->total.cycles < point->total.cycles || other->cost < point->cost)) {
+                point->pareto = 0;
+            }
+        }
+        numPareto += point->pareto;
+    }
+
+    FILE* csv = NULL;
+    if (csvFile) {
+        csv = fopen(csvFile, "w");
+        if (csv == NULL) {
+            printf("error: can't open file %s\n", csvFile);
+            exit(1);
+        }
+        fprintf(csv, "resolve,btb_entries,cache_words,cache_ways,block_words,miss_penalty,cycles,instructions,cpi,"
+                     "load_use_cycles,branch_cycles,cache_cycles,mispredicts,cache_accesses,cache_misses,"
+                     "storage_words,pareto\n");
+    }
+    printf("resolve\tbtb\tcache\tways\tblock\tpenalty\tcycles\t\tCPI\tload-use\tbranch\t\tcache\t\tstorage\n");
+    for (int i = 0; i < sweep.numPoints; ++i) {
+        pointType* point = &sweep.points[i];
+        unsigned long long branchCycles = point->total.mispredicts * (point->config.resolveInEx ? 2 : 3);
+        double cpi = point->instructions ? (double)point->total.cycles / (double)point->instructions : 0;
+        printConfig(stdout, &point->config, '\t');
+        printf("\t%llu\t\t%.3f\t%llu\t\t%llu\t\t%llu\t\t%lld%s\n", point->total.cycles, cpi, point->total.stalls,
+               branchCycles, point->total.waitCycles, point->cost, point->pareto ? "\t*" : "");
+        if (csv) {
+            printConfig(csv, &point->config, ',');
+            fprintf(csv, ",%llu,%llu,%.6f,%llu,%llu,%llu,%llu,%llu,%llu,%lld,%d\n", point->total.cycles,
+                    point->instructions, cpi, point->total.stalls, branchCycles, point->total.waitCycles,
+                    point->total.mispredicts, point->total.accesses, point->total.misses, point->cost,
+                    point->pareto);
+        }
+    }
+    if (csv && fclose(csv)) {
+        printf("error in writing %s\n", csvFile);
+        exit(1);
+    }
+    printf("%d configurations on %d programs (%d threads); %d Pareto-best (*) for cycles and storage\n",
+           sweep.numPoints, sweep.numBenchmarks, numThreads, numPareto);
+    return 0;
+}
+
+// comma-separated integers of at least min into values; returns how many
+int parseList(char* text, int* values, int min) {
+    int count = 0;
+    for (char* item = strtok(text, ","); item; item = strtok(NULL, ",")) {
+        char* end;
+        long value = strtol(item, &end, 10);
+        if (*end || value < min || value > NUMMEMORY || count == MAXVALUES) {
+            printf("error: bad parameter value %s\n", item);
+            exit(1);
+        }
+        values[count++] = (int)value;
+    }
+    if (!count) {
+        printf("error: empty parameter list\n");
+        exit(1);
+    }
+    return count;
+}
+
+// the program on the ISA (jalr does nothing, as in the pipeline); returns the instructions run, halt included.
+// Every instruction takes a cycle, so one that runs more than maxCycles cannot halt in time on any configuration.
+unsigned long long functionalRun(programType* program, char* filename, unsigned int maxCycles, int* reg, int* mem) {
+    memcpy(mem, program->mem, (size_t)program->numMemory * sizeof(int));
+    memset(reg, 0, NUMREGS * sizeof(int));
+    int pc = 0;
+    for (unsigned long long count = 1;; ++count) {
+        if (count > maxCycles) {
+            printf("error: %s did not halt within %u cycles\n", filename, maxCycles);
+            exit(1);
+        }
+        if (pc < 0 || pc >= NUMMEMORY) {
+            printf("error: pc %d out of range after %llu instructions\n", pc, count - 1);
+            exit(1);
+        }
+        int instr = program->mem[pc++];
+        int regA = reg[field0(instr)], regB = reg[field1(instr)];
+        int offset = convertNum(field2(instr));
+        int op = opcode(instr);
+        if (op == HALT) {
+            return count;
+        }
+        if (op == LW || op == SW) {
+            int addr = regA + offset;
+            if (addr < 0 || addr >= NUMMEMORY) {
+                printf("error: address %d out of range at pc %d\n", addr, pc - 1);
+                exit(1);
+            }
+            if (op == LW) {
+                reg[field1(instr)] = mem[addr];
+            } else {
+                mem[addr] = regB;
+            }
+        } else if (op == ADD) {
+            reg[field2(instr)] = regA + regB;
+        } else if (op == NOR) {
+            reg[field2(instr)] = ~(regA | regB);
+        } else if (op == BEQ && regA == regB) {
+            pc += offset;
+        }
+    }
+}
+
+void* worker(void* arg) {
+    sweepType* sweep = arg;
+    stateType* states[2] = {malloc(sizeof(stateType)), malloc(sizeof(stateType))};
+    int numRuns = sweep->numPoints * sweep->numBenchmarks;
+    for (int run; (run = __atomic_fetch_add(&sweep->next, 1, __ATOMIC_RELAXED)) < numRuns;) {
+        simulateRun(sweep, run / sweep->numBenchmarks, run % sweep->numBenchmarks, states);
+    }
+    free(states[0]);
+    free(states[1]);
+    return NULL;
+}
+
+void simulateRun(sweepType* sweep, int point, int index, stateType** states) {
+    benchmarkType* benchmark = &sweep->benchmarks[index];
+    runType* run = &sweep->runs[point * sweep->numBenchmarks + index];
+    pipelineModelType model;
+    initModel(&model, &sweep->points[point].config);
+
+    stateType* state = states[0];
+    stateType* newState = states[1];
+    memset(state->instrMem, 0, sizeof(state->instrMem));
+    memset(state->dataMem, 0, sizeof(state->dataMem));
+    loadMemory(state, benchmark->program.mem, benchmark->program.numMemory);
+    initState(state);
+    while (opcode(state->MEMWB.instr) != HALT) {
+        if (state->cycles >= sweep->maxCycles) {
+            printf("error: %s did not halt within %u cycles\n", benchmark->name, sweep->maxCycles);
+            exit(1);
+        }
+        cycleInfoType info;
+        simulateModelCycle(state, newState, &info, &model);
+        run->stalls += info.stall;
+        stateType* swap = state;
+        state = newState;
+        newState = swap;
+    }
+    if (memcmp(state->reg, benchmark->reg, sizeof(state->reg)) ||
+        memcmp(state->dataMem, benchmark->mem, NUMMEMORY * sizeof(int))) {
+        printf("error: %s computes a different result on ", benchmark->name);
+        printConfig(stdout, &sweep->points[point].config, ' ');
+        printf("\n");
+        exit(1);
+    }
+    run->cycles = state->cycles;
+    run->mispredicts = model.mispredicts;
+    run->accesses = model.accesses;
+    run->misses = model.misses;
+    run->waitCycles = model.waitCycles;
+    freeModel(&model);
+}
+
+// the configuration as the columns resolve, btb, cache, ways, block, penalty (ways and block are 0 without a cache)
+void printConfig(FILE* file, pipelineConfigType* config, char separator) {
+    fprintf(file, "%s%c%d%c%d%c%d%c%d%c%d", config->resolveInEx ? "ex" : "mem", separator, config->btbEntries,
+            separator, config->cacheWords, separator, config->cacheWays, separator, config->blockWords, separator,
+            config->missPenalty);
+}
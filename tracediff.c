@@ -0,0 +1,164 @@
+/*
+ * Streaming comparison of two LC-2K pipeline simulator traces.
+ * Reads both printState traces line by line and stops at the first
+ * difference, reporting the cycle, the field and both values.
+ * Memory use does not depend on the length of the traces.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAXLINELENGTH 4096     // longest trace line we compare in one piece
+#define STREAMBUFFER (1 << 20)  // stdio buffer per input file
+
+typedef struct traceStruct {
+    char* name;
+    FILE* file;
+    char line[MAXLINELENGTH];
+    long lineNum;
+    int eof;
+} traceType;
+
+void openTrace(traceType*, char*);
+int readLine(traceType*);
+void splitField(char*, char*, size_t, char**);
+int isDontCare(char*);
+
+int main(int argc, char* argv[]) {
+    static traceType a, b;
+    int ignoreDontCare = 0;  // -d: ignore differences in fields both traces mark (Don't Care)
+
+    int argi = 1;
+    if (argc == 4 && !strcmp(argv[1], "-d")) {
+        ignoreDontCare = 1;
+        ++argi;
+    }
+    if (argc - argi != 2) {
+        printf("error: usage: %s [-d] <trace> <trace>\n", argv[0]);
+        exit(2);
+    }
+    openTrace(&a, argv[argi]);
+    openTrace(&b, argv[argi + 1]);
+
+    long cycle = -1;         // cycle of the block being read, -1 before the first block
+    char section[64] = "";   // pipeline register the current line belongs to
+    while (1) {
+        int gotA = readLine(&a), gotB = readLine(&b);
+        if (!gotA && !gotB) {
+            printf("traces are identical (%ld lines)\n", a.lineNum);
+            return 0;
+        }
+        if (!gotA || !gotB) {
+            traceType* shorter = gotA ? &b : &a;
+            if (cycle < 0) {
+                printf("%s ends after %ld lines\n", shorter->name, shorter->lineNum);
+            } else {
+                printf("%s ends in cycle %ld\n", shorter->name, cycle);
+            }
+            return 1;
+        }
+
+        if (strcmp(a.line, b.line)) {
+            char fieldA[64], fieldB[64];
+            char *valueA, *valueB;
+            splitField(a.line, fieldA, sizeof(fieldA), &valueA);
+            splitField(b.line, fieldB, sizeof(fieldB), &valueB);
+            int sameField = !strcmp(fieldA, fieldB) && a.line[0] == '\t';
+            if (sameField && ignoreDontCare && isDontCare(a.line) && isDontCare(b.line)) {
+                continue;
+            }
+            if (cycle < 0) {
+                printf("first difference at line %ld, before the first cycle:\n", a.lineNum);
+            } else if (!sameField) {
+                printf("first difference in cycle %ld:\n", cycle);
+            } else {
+                printf("first difference in cycle %ld, %s%s%s:\n", cycle, section, *section ? " " : "", fieldA);
+            }
+            if (cycle < 0 || !sameField) {
+                valueA = a.line;
+                valueB = b.line;
+            }
+            printf("\t%s (line %ld): %s\n", a.name, a.lineNum, valueA);
+            printf("\t%s (line %ld): %s\n", b.name, b.lineNum, valueB);
+            return 1;
+        }
+
+        // identical lines: only track where we are
+        char* line = a.line;
+        if (!strncmp(line, "state before cycle ", 19)) {
+            cycle = strtol(line + 19, NULL, 10);
+            section[0] = '\0';
+        } else if (line[0] != '\t' || line[1] != '\t') {
+            // "\tIF/ID pipeline register:" starts a section, other headers end one
+            char* end = strstr(line, " pipeline register:");
+            size_t length = end && line[0] == '\t' ? (size_t)(end - line - 1) : 0;
+            if (length >= sizeof(section)) {
+                length = sizeof(section) - 1;
+            }
+            memcpy(section, line + 1, length);
+            section[length] = '\0';
+        }
+    }
+}
+
+void openTrace(traceType* trace, char* filename) {
+    trace->name = filename;
+    trace->file = fopen(filename, "r");
+    if (trace->file == NULL) {
+        printf("error: can't open file %s\n", filename);
+        exit(2);
+    }
+    setvbuf(trace->file, NULL, _IOFBF, STREAMBUFFER);
+    trace->lineNum = 0;
+    trace->eof = 0;
+}
+
+// read the next line without its newline; returns 0 at end of file
+int readLine(traceType* trace) {
+    if (trace->eof || fgets(trace->line, MAXLINELENGTH, trace->file) == NULL) {
+        trace->eof = 1;
+        return 0;
+    }
+    ++trace->lineNum;
+    size_t length = strlen(trace->line);
+    if (length > 0 && trace->line[length - 1] == '\n') {
+        trace->line[length - 1] = '\0';
+    }
+    return 1;
+}
+
+/*
+ * Split a trace line into the field name and its value, e.g.
+ *      "\t\tdataMem[ 17 ] = 5"            -> "dataMem[ 17 ]", "5"
+ *      "\t\tbranchTarget 3 (Don't Care)"  -> "branchTarget", "3 (Don't Care)"
+ *      "\t\teq ? True"                    -> "eq", "True"
+ **/
+void splitField(char* line, char* field, size_t size, char** value) {
+    while (*line == '\t') {
+        ++line;
+    }
+    char* end = strstr(line, " = ");
+    char* rest = end ? end + 3 : NULL;
+    if (end == NULL && (end = strstr(line, " ? ")) != NULL) {
+        rest = end + 3;
+    }
+    if (end == NULL && (end = strchr(line, ' ')) != NULL) {
+        rest = end + 1;
+    }
+    if (end == NULL) {
+        end = line;
+        rest = line;
+    }
+    size_t length = (size_t)(end - line);
+    if (length >= size) {
+        length = size - 1;
+    }
+    memcpy(field, line, length);
+    field[length] = '\0';
+    *value = rest;
+}
+
+int isDontCare(char* line) {
+    return strstr(line, "(Don't Care)") != NULL;
+}
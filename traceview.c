@@ -0,0 +1,51 @@
+/*
+ * Print cycles of a binary pipeline trace (simulator -B) as the printState
+ * blocks the simulator would have printed for them. Jumps to the snapshot
+ * before the first cycle through the trace's index, so the cost does not
+ * depend on where in the run the cycles are. Without a range, summarizes
+ * the trace.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bintrace.h"
+
+int main(int argc, char* argv[]) {
+    static stateType state;
+    binTraceType trace;
+
+    unsigned int first = 0, last = 0;
+    int range = argc == 3 ? sscanf(argv[2], "%u:%u", &first, &last) : 0;
+    if (argc < 2 || argc > 3 || (argc == 3 && range < 1)) {
+        printf("error: usage: %s <binary trace> [first[:last]]\n", argv[0]);
+        exit(1);
+    }
+    if (range == 1) {
+        last = first + 1;
+    }
+    binTraceLoad(&trace, argv[1]);
+
+    if (argc == 2) {
+        if (trace.numIndex == 0) {
+            printf("empty trace\n");
+            return 0;
+        }
+        binTraceSeek(&trace, trace.index[trace.numIndex - 1].cycle, &state);
+        while (binTraceNext(&trace, &state)) {
+        }
+        printf("cycles %u to %u, %d words of memory, %u snapshots\n", trace.index[0].cycle, state.cycles,
+               trace.numMemory, trace.numIndex);
+        return 0;
+    }
+
+    if (!binTraceSeek(&trace, first, &state)) {
+        printf("error: cycle %u is not in the trace\n", first);
+        exit(1);
+    }
+    do {
+        printState(&state);
+    } while (binTraceNext(&trace, &state) && state.cycles < last);
+    return 0;
+}
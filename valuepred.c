@@ -0,0 +1,129 @@
+/*
+ * Load-value prediction experiment.
+ * Simulates each program on the project 3 pipeline three times: as is,
+ * with a last-value load predictor and with a stride predictor (see
+ * loadPredictorType in pipeline.h). A confident prediction lets the
+ * instruction after a lw use its value without the load-use stall; a wrong
+ * one costs a three-cycle squash and replay instead of the one-cycle stall.
+ * Reports how often each predictor guessed, how often it was right and the
+ * net change in cycles, and checks that every run ends with the same
+ * registers and memory.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipeline.h"
+#include "program.h"
+
+typedef struct resultStruct {
+    unsigned long long cycles, stalls;
+    unsigned long long hazards, predictions, correct;
+} resultType;
+
+void simulate(programType*, char*, loadPredictorType*, stateType**, unsigned int, resultType*);
+
+int main(int argc, char* argv[]) {
+    static programType program;
+    static loadPredictorType predictor;
+    static stateType states[3];  // the baseline's final state is kept to compare against
+    unsigned int maxCycles = 100000000;  // -m <cycles>: give up simulating after this many cycles
+    const char* names[3] = {"no prediction", "last value", "stride"};
+
+    int argi = 1;
+    if (argc > 3 && !strcmp(argv[1], "-m")) {
+        maxCycles = strtoul(argv[2], NULL, 10);
+        argi = 3;
+    }
+    if (argi >= argc) {
+        printf("error: usage: %s [-m maxCycles] <machine-code file> ...\n", argv[0]);
+        exit(1);
+    }
+
+    unsigned long long totals[3] = {0, 0, 0}, predictions[3] = {0, 0, 0}, correct[3] = {0, 0, 0};
+    for (; argi < argc; ++argi) {
+        readProgram(&program, argv[argi]);
+        resultType results[3];
+        stateType* baseline = &states[2];
+        stateType* pair[2] = {&states[0], &states[1]};
+        simulate(&program, argv[argi], NULL, pair, maxCycles, &results[0]);
+        memcpy(baseline, pair[0], sizeof(stateType));
+
+        for (int mode = 1; mode < 3; ++mode) {
+            memset(&predictor, 0, sizeof(predictor));
+            predictor.stride = mode == 2;
+            pair[0] = &states[0];
+            pair[1] = &states[1];
+            simulate(&program, argv[argi], &predictor, pair, maxCycles, &results[mode]);
+            if (memcmp(pair[0]->reg, baseline->reg, sizeof(baseline->reg)) ||
+                memcmp(pair[0]->dataMem, baseline->dataMem, sizeof(baseline->dataMem))) {
+                printf("error: %s ends differently with %s prediction\n", argv[argi], names[mode]);
+                exit(1);
+            }
+        }
+
+        printf("%s: %llu cycles, %llu load-use stalls\n", argv[argi], results[0].cycles, results[0].stalls);
+        for (int mode = 0; mode < 3; ++mode) {
+            resultType* result = &results[mode];
+            totals[mode] += result->cycles;
+            predictions[mode] += result->predictions;
+            correct[mode] += result->correct;
+            if (mode == 0) {
+                continue;
+            }
+            printf("\t%s: %llu predicted of %llu hazards, %llu correct", names[mode], result->predictions,
+                   result->hazards, result->correct);
+            if (result->predictions) {
+                printf(" (%.1f%%)", 100.0 * (double)result->correct / (double)result->predictions);
+            }
+            printf(", %llu cycles (%+lld)\n", result->cycles, (long long)(result->cycles - results[0].cycles));
+        }
+    }
+
+    printf("total: %llu cycles\n", totals[0]);
+    for (int mode = 1; mode < 3; ++mode) {
+        printf("\t%s: %llu cycles (%+lld, %+.2f%%)", names[mode], totals[mode], (long long)(totals[mode] - totals[0]),
+               totals[0] ? 100.0 * ((double)totals[mode] - (double)totals[0]) / (double)totals[0] : 0.0);
+        if (predictions[mode]) {
+            printf(", %.1f%% of %llu predictions correct", 100.0 * (double)correct[mode] / (double)predictions[mode],
+                   predictions[mode]);
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+// run until halt reaches MEMWB; states[0] ends up holding the final state
+void simulate(programType* program, char* filename, loadPredictorType* predictor, stateType** states,
+              unsigned int maxCycles, resultType* result) {
+    stateType* state = states[0];
+    stateType* newState = states[1];
+    memset(state->dataMem, 0, sizeof(state->dataMem));  // the previous program may have left data past its end
+    memset(state->instrMem, 0, sizeof(state->instrMem));
+    loadMemory(state, program->mem, program->numMemory);
+    initState(state);
+    loadPredictor = predictor;
+    memset(result, 0, sizeof(*result));
+    while (opcode(state->MEMWB.instr) != HALT) {
+        if (state->cycles >= maxCycles) {
+            printf("error: %s did not halt within %u cycles\n", filename, maxCycles);
+            exit(1);
+        }
+        cycleInfoType info;
+        simulateCycle(state, newState, &info);
+        result->stalls += info.stall;
+        stateType* swap = state;
+        state = newState;
+        newState = swap;
+    }
+    loadPredictor = NULL;
+    states[0] = state;
+    states[1] = newState;
+    result->cycles = state->cycles;
+    if (predictor) {
+        result->hazards = predictor->hazards;
+        result->predictions = predictor->predictions;
+        result->correct = predictor->correct;
+    }
+}